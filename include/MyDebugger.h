@@ -6,9 +6,16 @@
 #include <stdint.h>
 
 #include <sys/reg.h>
+#include <sys/user.h>
+
+#include "unwind.h"
 
 
 #define X86_64_WORD_SIZE	sizeof(long int)
+// Larger than the XSAVE area of the current CPUs (AVX-512 included)
+#define XSAVE_AREA_MAX_SIZE	4096
+// Offset of the upper halves of YMM0-15 inside the XSAVE area (standard format)
+#define XSAVE_YMMH_OFFSET	576
 
 
 enum traced_process_state
@@ -28,20 +35,83 @@ void clean_debugger(void);
 
 void run_process(const char *executablePath, char *const argv[]);
 
+/* Attach the running process pid (PTRACE_SEIZE): all its threads are stopped */
+void attach_process(pid_t pid);
+
 /* Continue the process execution. If the process is terminated the function returns 0, otherwise if the process is stopped, function returns 1 */
 int continue_execution(void);
 
+/* Resume the process in background: it returns immediately (0 if the process terminated meanwhile) and the stops are handled by process_event() */
+int continue_background(void);
+
+/* Handle a state change of the threads resumed by continue. Return -1 if there is nothing to report, otherwise as continue_execution() */
+int process_event(void);
+
+/* Return 1 if the selected thread is running in background */
+int process_running(void);
+
+/* Stop the running process (PTRACE_INTERRUPT) and the tracing loops */
+void interrupt_process(void);
+
+/* Print the threads of the traced process (the selected one is marked by *) */
+void print_threads(void);
+
+/* Select the thread tid: the registers, the steps and the stops refer to it */
+void switch_thread(pid_t tid);
+
+/* In non-stop mode only the thread that reports a stop is stopped, in all-stop mode (default) all the threads stop */
+void set_non_stop(int enable);
+
+int non_stop_mode(void);
+
+/* Sample the call stacks of all the threads hz times per second for seconds seconds, then print the hot spots (see profile.c) 
+ * and write the collapsed stacks in path (if it isn't 0). The threads are stopped at the end. Return as continue_execution()
+ */
+int profile_execution(unsigned int hz, unsigned int seconds, const char *path);
+
 int trace_execution(void);
 
+/* Trace the execution logging the instructions (and the registers changed if with_regs) in a ring of capacity records mapped on path */
+int trace_record_execution(const char *path, uint64_t capacity, int with_regs);
+
+/* Trace the execution one basic block at a time (see MyDebugger.c) */
+int trace_blocks(void);
+
 int next_instruction(void);
 
 void kill_process(void);
 
-void set_breakpoint(uint64_t address);
+/* Remove all the breakpoints (the original bytes are restored) and detach the process, which goes on running */
+void detach_process(void);
+
+/* Set a persistent breakpoint. If auto_continue is not 0 the hits are counted but the process doesn't stop */
+void set_breakpoint(uint64_t address, int auto_continue);
 
 void delete_breakpoint(uint64_t address);
 
+void delete_all_breakpoints(void);
+
+/* The next count hits of the breakpoint at address don't stop the process */
+void ignore_breakpoint(uint64_t address, unsigned int count);
+
+void print_breakpoints(void);
+
+/* Unwind the stack of the selected thread: up to max frames, the first is RIP. Return the number of frames or -1 if the thread isn't stopped */
+int stack_trace(struct unwind_frame *frames, int max);
+
+void print_backtrace(void);
+
+/* Read length bytes from the traced process. Returns the bytes read (less than length if an unmapped page is reached) or -1 */
+ssize_t read_memory(uint64_t address, void *buffer, size_t length);
+
+/* Return the value of a general purpose register (sys/reg.h index). The registers are cached while the process is stopped */
 uint64_t get_register_value(unsigned int index);
 
+/* Return the x87/SSE registers of the stopped process or 0 */
+const struct user_fpregs_struct *get_fp_registers(void);
+
+/* Return the XSAVE area of the stopped process and its size or 0 if it isn't available */
+const unsigned char *get_xsave_state(size_t *size);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef _BPTABLE_H
+#define _BPTABLE_H
+
+
+#include <stdint.h>
+
+
+struct breakpoint_data_restore
+{
+  uint64_t address_at;
+  uint64_t hits;
+  unsigned int ignore_count;
+  unsigned char orig_byte;
+  char auto_continue;
+};
+
+/* Open addressing (linear probing) hash table of breakpoints keyed by address. An empty slot has address_at == 0 */
+struct breakpoint_table
+{
+  struct breakpoint_data_restore *slots;
+  unsigned int size;
+  unsigned int counter;
+};
+
+
+void bptable_init(struct breakpoint_table *bpt);
+
+void bptable_destroy(struct breakpoint_table *bpt);
+
+void bptable_clear(struct breakpoint_table *bpt);
+
+/* Return the breakpoint at address or 0 */
+struct breakpoint_data_restore *bptable_find(struct breakpoint_table *bpt, uint64_t address);
+
+/* Insert a new breakpoint and return its slot, or 0 if a breakpoint at address already exists. 
+ * The returned pointer is valid until the next insert or remove.
+ */
+struct breakpoint_data_restore *bptable_insert(struct breakpoint_table *bpt, uint64_t address);
+
+/* Remove the breakpoint at address. Return 0 if it doesn't exist */
+int bptable_remove(struct breakpoint_table *bpt, uint64_t address);
+
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _EVENTLOOP_H
+#define _EVENTLOOP_H
+
+
+#include <stdint.h>
+
+
+enum event_type
+{
+  EVENT_NONE =		0,
+  EVENT_INPUT =		1,	// the standard input is readable
+  EVENT_CHILD =		2,	// SIGCHLD: the traced process changed state
+  EVENT_INTERRUPT =	3,	// SIGINT (Ctrl-C)
+  EVENT_TIMER =		4	// the periodic timer expired
+};
+
+
+/* Block SIGCHLD and SIGINT: they are received through a signalfd multiplexed by epoll with the standard input */
+void init_event_loop(void);
+
+void destroy_event_loop(void);
+
+/* Restore the signal mask of the debugger. It's called by the child process before exec */
+void event_loop_child_reset(void);
+
+/* Arm the periodic timer (EVENT_TIMER) with a period of interval_ns nanoseconds, 0 disarms it */
+void event_timer(uint64_t interval_ns);
+
+/* Wait for the next event. The standard input is watched only if watch_input is not 0 */
+int event_wait(int watch_input);
+
+
+#endif
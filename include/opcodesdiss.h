@@ -2,12 +2,49 @@
 #define _OPCODESDISS_H
 
 
+#include <stdint.h>
+#include <stddef.h>
+
+
 #define INSTRUCTION_MAX_SIZE	16
+#define DECODED_TEXT_SIZE	80
+
+
+/* How an instruction changes the control flow */
+enum instruction_flow
+{
+  FLOW_NONE =		0,
+  FLOW_JUMP =		1,
+  FLOW_CONDJUMP =	2,
+  FLOW_CALL =		3,
+  FLOW_RET =		4,
+  FLOW_TRAP =		5	// int3, int, ud2, hlt ...
+};
+
+/* An instruction decoded by libopcodes, kept in the decode cache */
+struct decoded_instruction
+{
+  uint64_t address;
+  unsigned int page_gen;
+  int length;
+  char flow;
+  char text[DECODED_TEXT_SIZE];
+};
 
 
 void init_x86_64_diss(void);
 
-void print_instruction(unsigned char *instruction);
+/* Return the cached decode of the instruction at address or 0 if it isn't cached (or its page was changed) */
+const struct decoded_instruction *lookup_instruction(uint64_t address);
+
+/* Decode the instruction at address whose bytes are in instruction and cache it */
+const struct decoded_instruction *decode_instruction(uint64_t address, const unsigned char *instruction);
+
+/* The code in [address, address + length) is changed: the decoded instructions of its pages are discarded */
+void invalidate_instructions(uint64_t address, size_t length);
+
+/* The code mapping is changed: all the decoded instructions are discarded */
+void invalidate_all_instructions(void);
 
 
-#endif
\ No newline at end of file
+#endif
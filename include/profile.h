@@ -0,0 +1,50 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+
+#include <stdint.h>
+
+#include "unwind.h"
+
+
+// Rows printed by the hot spot tables
+#define PROFILE_TOP_FUNCTIONS	20
+
+/* Function seen by the profiler: address is its start (or the pc itself if it has no symbol) */
+struct profile_function
+{
+  uint64_t address;
+  // samples with the function on top of the stack
+  uint64_t self;
+  // samples with the function anywhere in the stack (the recursive calls are counted once)
+  uint64_t total;
+  uint64_t last_sample;
+};
+
+/* Distinct call stack: depth function addresses (the leaf first) stored from offset in the stacks buffer */
+struct profile_stack
+{
+  uint64_t hash;
+  uint64_t count;
+  size_t offset;
+  unsigned int depth;
+};
+
+
+/* Forget the samples of the previous profile */
+void profile_reset(void);
+
+/* Add a sample: the n frames of a call stack (see unwind_stack()) */
+void profile_add(const struct unwind_frame *frames, int n);
+
+/* Return the number of call stacks sampled */
+uint64_t profile_samples(void);
+
+/* Print the top functions by self samples (flat profile) and by total samples (inclusive profile) */
+void profile_report(unsigned int top);
+
+/* Write the collapsed stacks ("main;f;g count" lines, the input of the flame graph tools). Return -1 if path can't be written */
+int profile_write_folded(const char *path);
+
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _SYMBOLS_H
+#define _SYMBOLS_H
+
+
+#include <stdint.h>
+#include <unistd.h>
+
+
+/* Symbol of an ELF object. The name is an offset in the string table of the mapped file */
+struct symbol_entry
+{
+  uint64_t address;
+  uint32_t size;
+  uint32_t name;
+};
+
+/* ELF object (executable or shared object) mapped by the traced process. 
+ * The file is mmapped and its symbol table is indexed the first time a lookup needs it.
+ */
+struct symbol_object
+{
+  char *path;
+  uint64_t start;
+  uint64_t end;
+  // load address - link address
+  uint64_t bias;
+  unsigned char *image;
+  size_t image_size;
+  const char *strtab;
+  // sorted by address
+  struct symbol_entry *symbols;
+  // indexes of symbols sorted by name
+  uint32_t *by_name;
+  unsigned int count;
+  char loaded;
+  /* Unwind tables (see unwind.c): pointers in the mapped file and their link addresses */
+  const unsigned char *eh_frame_hdr;
+  uint64_t eh_frame_hdr_addr;
+  size_t eh_frame_hdr_size;
+  const unsigned char *eh_frame;
+  uint64_t eh_frame_addr;
+  size_t eh_frame_size;
+  char unwind_loaded;
+};
+
+
+/* Start the symbol lookups of the process pid. Nothing is read until the first lookup */
+void symbols_open(pid_t pid);
+
+/* Unmap all the objects */
+void symbols_close(void);
+
+/* Return the address of name (symbol or symbol+offset), 0 if it isn't found */
+uint64_t symbol_address(const char *name);
+
+/* Return the name of the symbol containing address and the offset of address inside it, 0 if it isn't found */
+const char *symbol_name(uint64_t address, uint64_t *offset);
+
+/* Return the object (mapped and indexed) containing address, 0 if address isn't in a file mapping. 
+ * It's valid until the maps are read again (a lookup that misses)
+ */
+struct symbol_object *symbol_object_at(uint64_t address);
+
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _THREADTABLE_H
+#define _THREADTABLE_H
+
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/user.h>
+
+
+/* State of a thread of the traced process */
+struct thread_state
+{
+  pid_t tid;
+  char state_flags;
+  // The thread was created but it hasn't reported its first stop yet
+  char starting;
+  // A PTRACE_INTERRUPT sent by the all-stop is pending: its stop has to be ignored
+  char interrupt_pending;
+  // The thread stopped on a breakpoint without counting the hit: RIP was moved back and the trap is executed again on resume
+  char bp_rewound;
+  int last_signal;
+  // PTRACE_EVENT_* of the last stop (0 for a signal or a trap)
+  int last_event;
+  // signal delivered to the thread on resume
+  int pending_signal;
+  // last resume request (PTRACE_CONT or PTRACE_SINGLESTEP): it's repeated after the stops handled by the debugger
+  int resume_request;
+  // breakpoint where the thread is stopped, its hit is already counted
+  uint64_t reported_bp;
+  /* Registers cache: it is filled by the first read after the thread stops and the writes are flushed before it resumes */
+  struct user_regs_struct regs;
+  char regs_valid;
+  char regs_dirty;
+};
+
+/* Open addressing hash table of the threads keyed by tid. The thread states are allocated, so their pointers are stable */
+struct thread_table
+{
+  struct thread_state **slots;
+  unsigned int size;
+  unsigned int counter;
+};
+
+
+void thtable_init(struct thread_table *tt);
+
+void thtable_destroy(struct thread_table *tt);
+
+/* Remove (and free) all the threads */
+void thtable_clear(struct thread_table *tt);
+
+struct thread_state *thtable_find(struct thread_table *tt, pid_t tid);
+
+/* Insert a new thread in the stopped state and return it, or 0 if it already exists */
+struct thread_state *thtable_insert(struct thread_table *tt, pid_t tid);
+
+/* Remove and free the thread tid. Return 0 if it doesn't exist */
+int thtable_remove(struct thread_table *tt, pid_t tid);
+
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _TRACELOG_H
+#define _TRACELOG_H
+
+
+#include <stdint.h>
+
+
+#define TRACELOG_MAGIC		"MDBGTRC1"
+#define TRACELOG_DEFAULT_SIZE	(1 << 20)
+
+enum trace_record_kind
+{
+  TRACE_INSN =	1,	// value is the address of an executed instruction
+  TRACE_REG =	2	// value is the new value of the register reg, changed by the previous instruction
+};
+
+/* Fixed size record of the ring buffer */
+struct trace_record
+{
+  uint64_t value;
+  uint32_t kind;
+  uint32_t reg;
+};
+
+/* Header of a trace file. It's followed by the ring of capacity records and, when the trace is closed, 
+ * by code_count snapshots of the traced instructions (used by the offline decoder).
+ */
+struct trace_header
+{
+  char magic[8];
+  uint32_t record_size;
+  uint32_t code_size;
+  uint64_t capacity;
+  uint64_t head;
+  uint64_t code_count;
+};
+
+/* Snapshot of the bytes of a traced instruction */
+struct trace_code
+{
+  uint64_t address;
+  unsigned char code[16];
+};
+
+
+/* Create the trace file path with a ring of capacity records. Return 0 on error */
+int tracelog_open(const char *path, uint64_t capacity);
+
+void tracelog_insn(uint64_t rip);
+
+void tracelog_reg(unsigned int reg, uint64_t value);
+
+/* Return 1 if the bytes of the instruction at address are already saved */
+int tracelog_has_code(uint64_t address);
+
+void tracelog_add_code(uint64_t address, const unsigned char *code);
+
+/* Write the instruction snapshots and close the trace file */
+void tracelog_close(void);
+
+/* Print the last count instructions (all if count is 0) of a trace file */
+int tracelog_decode(const char *path, uint64_t count);
+
+
+#endif
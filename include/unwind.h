@@ -0,0 +1,29 @@
+#ifndef _UNWIND_H
+#define _UNWIND_H
+
+
+#include <stdint.h>
+#include <unistd.h>
+
+
+#define UNWIND_MAX_FRAMES	256
+
+/* A frame of the call stack: the pc (the return address for the callers) and the canonical frame address */
+struct unwind_frame
+{
+  uint64_t pc;
+  uint64_t cfa;
+};
+
+/* Read the memory of the traced process: return the bytes read (less than length at the end of a mapping) or -1 */
+typedef ssize_t (*memory_reader)(uint64_t address, void *buffer, size_t length);
+
+
+/* Unwind the stack starting from the registers rip, rsp and rbp. Write up to max frames (the first is rip) and return how many */
+int unwind_stack(uint64_t rip, uint64_t rsp, uint64_t rbp, memory_reader read, struct unwind_frame *frames, int max);
+
+/* Forget the cached unwind rules (new process or program) */
+void unwind_reset(void);
+
+
+#endif
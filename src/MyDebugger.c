@@ -1,13 +1,26 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <elf.h>
 #include <sys/wait.h>
 #include <sys/user.h>
 
 #include "opcodesdiss.h"
+#include "bptable.h"
+#include "threadtable.h"
+#include "tracelog.h"
+#include "symbols.h"
+#include "unwind.h"
+#include "profile.h"
+#include "eventloop.h"
 #include "MyDebugger.h"
 
 
@@ -21,45 +34,105 @@ do{							\
   }							\
 }while(0)
 
+// The selected thread is stopped by a trap (breakpoint or single step), not by a signal or by a ptrace event
+#define TRAP_STOP()	(mdbg->curr->state_flags == INTERRUPTED && mdbg->curr->last_signal == SIGTRAP && mdbg->curr->last_event == 0)
 
 
 struct MyDebugger;
-struct breakpoint_data_restore;
+struct text_patch;
 
-struct breakpoint_data_restore
+struct MyDebugger
 {
-  uint64_t address_at;
-  uint64_t orig_instruction;
+  struct breakpoint_table bpt;
+  struct thread_table threads;
+  // selected thread: the registers, the steps and the stop state refer to it
+  struct thread_state *curr;
+  // curr when no process is traced (DISABLED)
+  struct thread_state no_thread;
+  pid_t traced_id;
+  int mem_fd;
+  /* Floating point registers cache of the selected thread */
+  struct user_fpregs_struct fpregs;
+  unsigned char *xstate;
+  size_t xstate_size;
+  char fpregs_valid;
+  char xstate_valid;
+  // Only the thread that reports a stop is stopped, the others keep running
+  char non_stop;
+  // The process has been attached: it's detached (not killed) when the debugger quits
+  char attached;
+  // Ctrl-C or interrupt command: the running loops (flow, continue) stop
+  char interrupt_requested;
 };
 
-struct MyDebugger
+/* A single byte to write in the text of the traced process */
+struct text_patch
 {
-  struct breakpoint_data_restore *bdr;
-  pid_t traced_id;
-  int breakpoints_counter;
-  char state_flags;
+  uint64_t address;
+  unsigned char byte;
 };
 
 
 static int wait_process(void);
+static int wait_event(pid_t tid, int nohang);
+static int process_status(int status);
+static void hold_thread(struct thread_state *th, int status);
+static int stop_all_threads(void);
+static int resume_all(void);
+static pid_t *running_threads(int *n);
+static struct thread_state *add_thread(pid_t tid);
+static void remove_thread(struct thread_state *th);
+static void release_threads(void);
+static void select_thread(struct thread_state *th);
+static void report_thread_switch(pid_t prev);
+static int seize_threads(pid_t pid);
+static int sample_threads(void);
+static void print_address(uint64_t address);
+static int compare_tids(const void *a, const void *b);
+static int continue_stop(int ret);
+static int resume_nowait(int request);
 static void _delete_breakpoint(uint64_t address);
 static int _next_instruction(void);
 static int detect_breakpoint(uint64_t address);
 static void restore_after_breakpoint(uint64_t address);
-static void get_data(uint64_t address, void *wbuffer, size_t length);
-static void set_data(uint64_t address, const void *rbuffer, size_t length);
+static int breakpoint_hit(struct breakpoint_data_restore *bp);
+static void insert_trap(struct breakpoint_data_restore *bp);
+static void remove_trap(struct breakpoint_data_restore *bp);
+static void write_patches(struct text_patch *patches, int n);
+static void shadow_breakpoints(uint64_t address, unsigned char *buffer, size_t length);
+static int resume_process(int request);
+static int step_over_breakpoint(uint64_t address);
+static void log_register_deltas(struct user_regs_struct *prev);
+static uint64_t find_block_end(uint64_t address, char *branch_text);
+static int run_to(uint64_t address);
+static void open_memory(void);
+static void close_memory(void);
+static ssize_t get_data(uint64_t address, void *wbuffer, size_t length);
+static ssize_t set_data(uint64_t address, const void *rbuffer, size_t length);
+static ssize_t get_text(uint64_t address, void *wbuffer, size_t length);
+static ssize_t set_text(uint64_t address, const void *rbuffer, size_t length);
+static ssize_t peek_data(uint64_t address, void *wbuffer, size_t length);
+static ssize_t poke_data(uint64_t address, const void *rbuffer, size_t length);
 static uint64_t get_register(unsigned int regaddr);
 static void set_register(unsigned int regaddr, uint64_t value);
+static void load_registers(void);
+static void flush_registers(void);
+static void invalidate_registers(void);
+static void ptrace_resume(int request);
 
 
 struct MyDebugger *mdbg = 0;
-static int bdr_size = 8;
+// set when the kernel doesn't provide process_vm_readv/process_vm_writev
+static int vm_rw_unsupported = 0;
 
-// breakpoint instruction
-char trap_instruction[8] = 
-{
-  0xcc, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0
-};
+// ptrace options of the traced processes (the started ones are killed with the debugger too)
+#define TRACE_OPTIONS		(PTRACE_O_TRACEEXEC | PTRACE_O_TRACECLONE)
+
+// breakpoint instruction (INT3)
+#define TRAP_INSTRUCTION	0xcc
+// Block stepping decodes the code in chunks of BLOCK_READ_SIZE bytes, up to BLOCK_MAX_INSTRUCTIONS per block
+#define BLOCK_READ_SIZE		256
+#define BLOCK_MAX_INSTRUCTIONS	4096
 
 
 void init_debugger(void)
@@ -69,41 +142,56 @@ void init_debugger(void)
   
   mdbg = malloc(sizeof(struct MyDebugger));
   memset(mdbg, 0, sizeof(struct MyDebugger));
+  mdbg->mem_fd = -1;
+  mdbg->curr = &mdbg->no_thread;
   
-  mdbg->bdr = malloc(sizeof(struct breakpoint_data_restore) * bdr_size);
-  memset(mdbg->bdr, 0, sizeof(struct breakpoint_data_restore) * bdr_size);
+  bptable_init(&mdbg->bpt);
+  thtable_init(&mdbg->threads);
   
   init_x86_64_diss();
+  init_event_loop();
 }
 
 void destroy_debugger(void)
 {
-  if(mdbg->state_flags != DISABLED)
+  if(mdbg->curr->state_flags != DISABLED && mdbg->attached)
+    detach_process();
+  else if(mdbg->curr->state_flags != DISABLED)
     kill_process();
   
-  free(mdbg->bdr);
+  bptable_destroy(&mdbg->bpt);
+  thtable_destroy(&mdbg->threads);
+  free(mdbg->xstate);
   free(mdbg);
   
+  destroy_event_loop();
+  
   mdbg = 0;
 }
 
 void clean_debugger(void)
 {
-  if(mdbg->state_flags != DISABLED && mdbg->state_flags != FAULT)
+  if(mdbg->curr->state_flags != DISABLED && mdbg->curr->state_flags != FAULT)
         printf("Traced process is still running. You have to terminate it and then clean the debugger\n");
   else
   {
+    close_memory();
+    symbols_close();
+    unwind_reset();
+    invalidate_all_instructions();
+    bptable_clear(&mdbg->bpt);
+    release_threads();
     mdbg->traced_id = 0;
-    mdbg->state_flags = DISABLED;
+    mdbg->attached = 0;
     //All clean operation
   }
 }
 
 void run_process(const char *executablePath, char *const argv[])
 {
-  int c_pid;
+  int c_pid, status;
   
-  if(mdbg->state_flags != DISABLED)
+  if(mdbg->curr->state_flags != DISABLED)
   {
     printf("The process is already running\n");
     return;
@@ -113,354 +201,1903 @@ void run_process(const char *executablePath, char *const argv[])
   if(c_pid == 0)
   {
     /*** Child process ***/
-    SECURE_SCALL( ptrace(PTRACE_TRACEME, 0, NULL, NULL) );
-    SECURE_SCALL( execv(executablePath, argv) );
+    // It waits to be seized by the debugger, so it can be interrupted with PTRACE_INTERRUPT
+    event_loop_child_reset();
+    raise(SIGSTOP);
+    execv(executablePath, argv);
+    fprintf(stderr, "%s\n", strerror(errno));
+    _exit(127);
+  }
+  
+  SECURE_SCALL( waitpid(c_pid, &status, WSTOPPED) );
+  SECURE_SCALL( ptrace(PTRACE_SEIZE, c_pid, NULL, PTRACE_O_EXITKILL | TRACE_OPTIONS) );
+  kill(c_pid, SIGCONT);
+  
+  /* Skips the stops of SIGSTOP/SIGCONT until the exec */
+  while(1)
+  {
+    SECURE_SCALL( waitpid(c_pid, &status, __WALL) );
+    if(WIFEXITED(status) || WIFSIGNALED(status))
+    {
+      printf("The process can't be started\n");
+      return;
+    }
+    if((status >> 16) == PTRACE_EVENT_EXEC)
+      break;
+    SECURE_SCALL( ptrace(PTRACE_CONT, c_pid, NULL, NULL) );
   }
   
   mdbg->traced_id = c_pid;
-  mdbg->state_flags = RUNNING;
-    
-  if(wait_process() == 1)
-    printf("Ok, the process is traced! pid: %d\n", mdbg->traced_id);
+  select_thread(add_thread(c_pid));
+  mdbg->curr->last_signal = SIGTRAP;
+  mdbg->curr->last_event = PTRACE_EVENT_EXEC;
+  
+  open_memory();
+  symbols_open(c_pid);
+  unwind_reset();
+  printf("Ok, the process is traced! pid: %d\n", mdbg->traced_id);
 }
 
-int continue_execution(void)
+/* Attach a running process: all its threads are seized and interrupted, the process isn't restarted */
+void attach_process(pid_t pid)
 {
-  uint64_t address;
-  int ret;
+  struct thread_state *th;
+  struct timespec start, end;
   
-  if(mdbg->state_flags == FAULT)
+  if(mdbg->curr->state_flags != DISABLED)
   {
-    printf("Process received a segmentation fault\n");
-    return 1;
+    printf("The process is already running\n");
+    return;
   }
   
-  if(mdbg->state_flags != INTERRUPTED)
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  
+  if(ptrace(PTRACE_SEIZE, pid, NULL, TRACE_OPTIONS) == -1)
   {
-    printf("Process is not running\n");
-    return 0;
+    printf("Cannot attach to process %d: %s\n", pid, strerror(errno));
+    return;
   }
   
-  mdbg->state_flags = RUNNING;
-  SECURE_SCALL( ptrace(PTRACE_CONT, mdbg->traced_id, NULL, NULL) );
+  mdbg->traced_id = pid;
+  mdbg->attached = 1;
+  th = add_thread(pid);
+  th->state_flags = RUNNING;
+  select_thread(th);
   
-  ret = wait_process();
-  //If traced process has been interrupted checks if a breakpoint has occurred
-  if(ret == 1)
+  // The threads created meanwhile by a thread not seized yet are found by the next scan
+  while(seize_threads(pid) != 0)
+    ;
+  
+  if(stop_all_threads() == 0)
   {
-    //The last instruction executed at one byte first, is it INT3 ?
-    address = get_register(RIP);
-    address -= 1;
-    if(detect_breakpoint(address))
-    {
-      printf("Breakpoint at %lx\n", address);
-      restore_after_breakpoint(address);
-    }
+    clean_debugger();
+    return;
   }
   
-  return ret;
+  open_memory();
+  symbols_open(pid);
+  unwind_reset();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("Attached to process %d (%u threads) in %.3f ms\n", pid, mdbg->threads.counter, 
+	 (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
 }
 
-int trace_execution(void)
+int continue_execution(void)
 {
+  pid_t prev;
   int ret;
   
-  if(mdbg->state_flags == FAULT)
+  if(mdbg->curr->state_flags == FAULT)
   {
     printf("Process received a segmentation fault\n");
     return 1;
   }
   
-  if(mdbg->state_flags != INTERRUPTED)
+  if(mdbg->curr->state_flags != INTERRUPTED)
   {
     printf("Process is not running\n");
     return 0;
   }
   
-  do
+  mdbg->interrupt_requested = 0;
+  prev = mdbg->curr->tid;
+  
+  ret = resume_all();
+  while(1)
+  {
+    if(ret == -1)
+      ret = wait_event(-1, 0);
+    if((ret = continue_stop(ret)) != 2)
+      break;
+    ret = resume_all();
+  }
+  
+  if(ret == 1)
   {
-    if(mdbg->state_flags == FAULT || _next_instruction())
-      return 1;
+    if(!mdbg->non_stop)
+      ret = stop_all_threads();
+    report_thread_switch(prev);
   }
-  while(( ret = wait_process()));
   
   return ret;
 }
 
-int next_instruction(void)
+int continue_background(void)
 {
-  if(mdbg->state_flags == FAULT)
+  pid_t prev;
+  int ret;
+  
+  if(mdbg->curr->state_flags == FAULT)
   {
     printf("Process received a segmentation fault\n");
     return 1;
   }
   
-  if(mdbg->state_flags != INTERRUPTED)
+  if(mdbg->curr->state_flags != INTERRUPTED)
   {
     printf("Process is not running\n");
     return 0;
   }
   
-  if(_next_instruction())
-    return 1;
+  mdbg->interrupt_requested = 0;
+  prev = mdbg->curr->tid;
   
-  return wait_process();
+  // The thread stopped while a breakpoint was stepped over
+  ret = resume_all();
+  while(ret != -1)
+  {
+    if((ret = continue_stop(ret)) != 2)
+    {
+      if(ret == 1)
+      {
+	if(!mdbg->non_stop)
+	  ret = stop_all_threads();
+	report_thread_switch(prev);
+      }
+      return ret;
+    }
+    ret = resume_all();
+  }
+  
+  return 1;
 }
 
-/* Execute the next instruction. If it is a break instruction don't execute it and return 1. */
-int _next_instruction(void)
+int process_event(void)
 {
-  uint64_t address;
-  unsigned char instruction_traced[INSTRUCTION_MAX_SIZE];
+  struct thread_state *th;
+  pid_t prev;
+  int ret;
   
-  address = get_register(RIP);
-  if(detect_breakpoint(address))
+  if(mdbg->curr->state_flags == DISABLED)
+    return -1;
+  
+  prev = mdbg->curr->tid;
+  
+  ret = wait_event(-1, 1);
+  while(ret != -1)
   {
-    printf("Breakpoint at %lx\n", address);
-    restore_after_breakpoint(address);
-    return 1;
+    if((ret = continue_stop(ret)) != 2)
+    {
+      if(ret == 1)
+      {
+	if(!mdbg->non_stop)
+	  ret = stop_all_threads();
+	report_thread_switch(prev);
+      }
+      return ret;
+    }
+    
+    // The ignored and auto-continue breakpoints resume the thread without going back to the user
+    if((ret = resume_all()) == -1)
+      ret = wait_event(-1, 1);
   }
   
-  get_data(address, instruction_traced, INSTRUCTION_MAX_SIZE);
-  
-  printf("%lx: \t\t", address);
-  print_instruction(instruction_traced);
-  mdbg->state_flags = RUNNING;
-  SECURE_SCALL( ptrace(PTRACE_SINGLESTEP, mdbg->traced_id, NULL, NULL) );
+  // Nothing to report: the thread selected by the user stays selected
+  if((th = thtable_find(&mdbg->threads, prev)) != 0)
+    select_thread(th);
   
-  return 0;
+  return -1;
 }
 
-void kill_process(void)
+int process_running(void)
 {
-  if(mdbg->state_flags == DISABLED)
-    printf("The traced process is not running\n");
-  else
-  {
-    printf("Killing the traced process\n");
-    kill(mdbg->traced_id, SIGKILL);
-    if(wait(0) == -1)
-      printf("Traced process is in a zombie state because an error has occurred: %s\n", strerror(errno));
-    mdbg->state_flags = DISABLED;
-    clean_debugger();
-  }
+  return mdbg->curr->state_flags == RUNNING;
 }
 
-void set_breakpoint(uint64_t address)
+void interrupt_process(void)
 {
-  struct breakpoint_data_restore *curr;
-  uint64_t instruction;
-  
-  if(mdbg->state_flags == FAULT)
-  {
-    printf("Process received a segmentation fault\n");
-    return;
-  }
-  
-  if(mdbg->state_flags == DISABLED)
-  {
-    printf("The traced process is not running\n");
-    return;
-  }
-    
-  if(mdbg->breakpoints_counter == bdr_size)
-  {
-    bdr_size *= 2;
-    mdbg->bdr = realloc(mdbg->bdr, sizeof(struct breakpoint_data_restore) * bdr_size);
-  }
-  
-  get_data(address, &instruction, X86_64_WORD_SIZE);
+  mdbg->interrupt_requested = 1;
   
-  curr = mdbg->bdr + mdbg->breakpoints_counter;
-  curr->address_at = address;
-  curr->orig_instruction = instruction;
-  mdbg->breakpoints_counter++;
-  
-  set_data(address, trap_instruction, X86_64_WORD_SIZE);
+  if(mdbg->curr->state_flags == RUNNING)
+    ptrace(PTRACE_INTERRUPT, mdbg->curr->tid, NULL, NULL);
 }
 
-void delete_breakpoint(uint64_t address)
+void print_threads(void)
 {
-  if(mdbg->state_flags == DISABLED)
+  struct thread_state *th;
+  pid_t *tids;
+  unsigned int i;
+  int n = 0, j;
+  
+  if(mdbg->curr->state_flags == DISABLED)
   {
     printf("The traced process is not running\n");
     return;
   }
   
-  _delete_breakpoint(address);
-}
-
-void _delete_breakpoint(uint64_t address)
-{
-  struct breakpoint_data_restore *curr, *last;
-  int i;
-    
-  last = mdbg->bdr + (mdbg->breakpoints_counter - 1); 
+  tids = malloc(sizeof(pid_t) * mdbg->threads.counter);
+  for(i = 0; i < mdbg->threads.size; i++)
+    if(mdbg->threads.slots[i] != 0)
+      tids[n++] = mdbg->threads.slots[i]->tid;
+  qsort(tids, n, sizeof(pid_t), compare_tids);
   
-  for(i = 0; i < mdbg->breakpoints_counter; i++)
+  for(j = 0; j < n; j++)
   {
-    curr = mdbg->bdr + i;
-    if(curr->address_at == address)
+    th = thtable_find(&mdbg->threads, tids[j]);
+    printf("%c %d\t", th == mdbg->curr ? '*' : ' ', th->tid);
+    if(th->state_flags == RUNNING)
     {
-      set_data(curr->address_at, &curr->orig_instruction, X86_64_WORD_SIZE);
-      /* Moves last block on the deleted block - Deletes last block and decrements the breakpoints_counter */
-      curr->address_at = last->address_at;
-      curr->orig_instruction = last->orig_instruction;
-      last->address_at = 0;
-      last->orig_instruction = 0;
-      mdbg->breakpoints_counter--;
-      
-      return;
+      printf("running\n");
+      continue;
     }
+    
+    if(!th->regs_valid && ptrace(PTRACE_GETREGS, th->tid, NULL, &th->regs) != -1)
+      th->regs_valid = 1;
+    printf("%s\t%llx\n", th->state_flags == FAULT ? "fault" : "stopped", th->regs.rip);
   }
   
-  printf("Breakpoint doesn't exist\n");
+  free(tids);
 }
 
-uint64_t get_register_value(unsigned int index)
+void switch_thread(pid_t tid)
 {
-  if(mdbg->state_flags == DISABLED)
+  struct thread_state *th;
+  
+  if( (th = thtable_find(&mdbg->threads, tid)) == 0)
   {
-    printf("The traced process is not running\n");
-    return 0;
+    printf("Thread %d doesn't exist\n", tid);
+    return;
   }
   
-  return get_register(index);
+  select_thread(th);
+  printf("[Switching to thread %d]\n", tid);
 }
 
-static int detect_breakpoint(uint64_t address)
+void set_non_stop(int enable)
 {
-  uint64_t intr;
-  
-  get_data(address, &intr, X86_64_WORD_SIZE);
-  if(intr == *((uint64_t*)trap_instruction))
-    return 1;
+  mdbg->non_stop = enable;
   
-  return 0;
+  // The other threads are stopped as the selected one
+  if(!enable && mdbg->curr->state_flags != DISABLED && mdbg->curr->state_flags != RUNNING)
+    stop_all_threads();
 }
 
-void restore_after_breakpoint(uint64_t address)
+int non_stop_mode(void)
 {
-  //Restore the RIP register after the breakpoint instruction
-  _delete_breakpoint(address);
-  set_register(RIP, address);
+  return mdbg->non_stop;
 }
 
-/* Wait for the traced process and control its exited status. 
- * Return 0 if the process terminates the execution, 1 if the process is stopped by a signal (usually a SIGTRAP) or a segmentation fault was occurred
- */
-static int wait_process(void)
+int profile_execution(unsigned int hz, unsigned int seconds, const char *path)
 {
-  int status = 0;
+  struct timespec start, now, t0, t1;
+  uint64_t elapsed = 0, sampling = 0, ticks = 0;
+  pid_t prev;
+  int ret, event;
   
-  if(mdbg->state_flags != RUNNING)
+  if(mdbg->curr->state_flags == FAULT)
   {
-    /* WARNING: This conditional statement should not never becomes true, otherwise abort the process */
-    
-    printf("Error code 001 (The process is not running).\n");
-    abort();
+    printf("Process received a segmentation fault\n");
+    return 1;
   }
   
-  while(wait(&status) == -1)
+  if(mdbg->curr->state_flags != INTERRUPTED)
   {
-    if(errno == EINTR)
+    printf("Process is not running\n");
+    return 0;
+  }
+  
+  if(hz == 0 || hz > 10000 || seconds == 0)
+  {
+    printf("Enter a frequency (1-10000 Hz) and a duration in seconds\n");
+    return 1;
+  }
+  
+  mdbg->interrupt_requested = 0;
+  prev = mdbg->curr->tid;
+  profile_reset();
+  
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  event_timer(1000000000ULL / hz);
+  
+  /* The threads run as resumed by continue, the stops to report end the profile. 
+   * Each tick of the timer stops all the threads, unwinds their stacks and resumes them
+   */
+  ret = resume_all();
+  while(1)
+  {
+    if(ret != -1)
+    {
+      if((ret = continue_stop(ret)) != 2)
+	break;
+      if((ret = resume_all()) == -1)
+	ret = wait_event(-1, 1);
       continue;
-    else
+    }
+    
+    if((event = event_wait(0)) == EVENT_CHILD)
+      ret = wait_event(-1, 1);
+    else if(event == EVENT_INTERRUPT)
     {
-      /* WARNING: this conditional statement should not never becomes true, otherwise abort the process */
-      
-      fprintf(stderr, "%s\n", strerror(errno));
-      if(errno != ECHILD)
-	kill(SIGTERM, mdbg->traced_id);
+      printf("Profile interrupted\n");
+      break;
+    }
+    else if(event == EVENT_TIMER)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      elapsed = (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+      if(elapsed >= seconds * 1000000000ULL)
+	break;
       
-      abort();
+      // The cost of a tick is the CPU time of the debugger: the wall time includes the run of the threads resumed (on the same CPU)
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+      ret = sample_threads();
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+      sampling += (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+      ticks++;
     }
   }
   
-  //The traced process was terminated normally.
-  if(WIFEXITED(status))
+  event_timer(0);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+  
+  // The threads are stopped at the end of the profile as after a continue
+  if(ret == -1 || (ret == 1 && !mdbg->non_stop))
+    ret = stop_all_threads();
+  
+  printf("%lu samples in %lu ticks over %.3f s, %.1f us of debugger CPU time per tick\n", profile_samples(), ticks, elapsed / 1e9, ticks != 0 ? sampling / 1e3 / ticks : 0.0);
+  profile_report(PROFILE_TOP_FUNCTIONS);
+  if(path != 0 && profile_samples() != 0)
   {
-    printf("The process is terminated with code %d\n", WEXITSTATUS(status));
-    mdbg->state_flags = DISABLED;
-    return 0;
+    if(profile_write_folded(path) == -1)
+      printf("Cannot write %s: %s\n", path, strerror(errno));
+    else
+      printf("Collapsed stacks written to %s\n", path);
   }
   
-  //The traced process was terminated by a signal that it was not caught
-  if(WIFSIGNALED(status))
+  if(ret == 1)
+    report_thread_switch(prev);
+  
+  return ret;
+}
+
+int trace_execution(void)
+{
+  int ret;
+  
+  if(mdbg->curr->state_flags == FAULT)
   {
-    printf("The process is terminated by signal %s\n", strsignal(WTERMSIG(status)));
-    mdbg->state_flags = DISABLED;
+    printf("Process received a segmentation fault\n");
+    return 1;
+  }
+  
+  if(mdbg->curr->state_flags != INTERRUPTED)
+  {
+    printf("Process is not running\n");
     return 0;
   }
   
-  //A segmentation fault has occurred in the traced process, so it is currently stopped
-  if(WIFSTOPPED(status) && (WSTOPSIG(status) == SIGSEGV))
+  mdbg->interrupt_requested = 0;
+  
+  while((ret = _next_instruction()) == 2)
   {
-    mdbg->state_flags = FAULT;
-    printf("Segmentation fault :(\n");
-    return 1;
+    if(mdbg->interrupt_requested)
+    {
+      printf("Interrupted at %lx\n", get_register(RIP));
+      return 1;
+    }
   }
-
-  mdbg->state_flags = INTERRUPTED;
   
-  //if the process was interrupted by a signal then print the signal
-  if(WIFSTOPPED(status) && (WSTOPSIG(status) != SIGTRAP))
-    printf("The process receive a %s signal\n", strsignal(WSTOPSIG(status)));
-
-  return 1;
+  return ret;
 }
 
-static void get_data(uint64_t address, void *wbuffer, size_t length)
+/* As trace_execution() but the instructions are logged in the binary trace file path instead of being printed */
+int trace_record_execution(const char *path, uint64_t capacity, int with_regs)
 {
-  size_t size_blocks = length / X86_64_WORD_SIZE;
-  char *curr = (char*)wbuffer;
-  uint64_t block;
-  int c;
+  struct breakpoint_data_restore *bp;
+  struct user_regs_struct prev;
+  struct timespec start, end;
+  unsigned char instruction_traced[INSTRUCTION_MAX_SIZE];
+  uint64_t address, counter = 0;
+  double elapsed;
+  int ret;
   
-  for(c = 0; c < size_blocks; c++)
+  if(mdbg->curr->state_flags == FAULT)
   {
-    SECURE_SCALL( (block = ptrace(PTRACE_PEEKDATA, mdbg->traced_id, address + (c * X86_64_WORD_SIZE), NULL)) );
-    memcpy(curr, &block, X86_64_WORD_SIZE);
-    curr += X86_64_WORD_SIZE;
+    printf("Process received a segmentation fault\n");
+    return 1;
+  }
+  
+  if(mdbg->curr->state_flags != INTERRUPTED)
+  {
+    printf("Process is not running\n");
+    return 0;
   }
-  if((length % X86_64_WORD_SIZE) != 0)
+  
+  if(!tracelog_open(path, capacity))
+    return 1;
+  
+  mdbg->interrupt_requested = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  
+  get_register(RIP);
+  prev = mdbg->curr->regs;
+  
+  while(1)
   {
-    SECURE_SCALL( (block = ptrace(PTRACE_PEEKDATA, mdbg->traced_id, address + (c * X86_64_WORD_SIZE), NULL)) );
-    memcpy(curr, &block, X86_64_WORD_SIZE);
+    address = get_register(RIP);
+    if(address != mdbg->curr->reported_bp && (bp = bptable_find(&mdbg->bpt, address)) != 0 && breakpoint_hit(bp))
+    {
+      ret = 1;
+      break;
+    }
+    
+    if(mdbg->interrupt_requested)
+    {
+      printf("Interrupted at %lx\n", address);
+      ret = 1;
+      break;
+    }
+    
+    // The bytes of every instruction are read only the first time, for the offline decoder
+    if(!tracelog_has_code(address))
+    {
+      memset(instruction_traced, 0, INSTRUCTION_MAX_SIZE);
+      get_text(address, instruction_traced, INSTRUCTION_MAX_SIZE);
+      tracelog_add_code(address, instruction_traced);
+    }
+    tracelog_insn(address);
+    counter++;
+    
+    if((ret = resume_process(PTRACE_SINGLESTEP)) != 1)
+      break;
+    if(with_regs)
+      log_register_deltas(&prev);
+    if(!TRAP_STOP())
+      break;
   }
+  
+  tracelog_close();
+  
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%lu instructions traced in %.3f s (%.0f instructions/s)\n", counter, elapsed, elapsed > 0 ? counter / elapsed : 0);
+  
+  return ret;
 }
 
-static void set_data(uint64_t address, const void *rbuffer, size_t length)
+/* Execute the process one basic block at a time: the straight-line code runs at native speed up to the next control transfer 
+ * instruction (a temporary trap is placed there), then the branch is single-stepped. Each block is printed.
+ */
+int trace_blocks(void)
 {
-  size_t size_blocks = length / X86_64_WORD_SIZE;
-  const char *curr = (char*)rbuffer;
-  uint64_t block;
-  int c;
+  struct breakpoint_data_restore *bp;
+  struct timespec start, end;
+  char branch_text[DECODED_TEXT_SIZE];
+  uint64_t address, block_end, stop_address, counter = 0;
+  double elapsed;
+  int ret;
+  
+  if(mdbg->curr->state_flags == FAULT)
+  {
+    printf("Process received a segmentation fault\n");
+    return 1;
+  }
   
-  for(c = 0; c < size_blocks; c++)
+  if(mdbg->curr->state_flags != INTERRUPTED)
   {
-    memcpy(&block, curr, X86_64_WORD_SIZE);
-    SECURE_SCALL( (ptrace(PTRACE_POKEDATA, mdbg->traced_id, address + (c * X86_64_WORD_SIZE), block)) );
-    curr += X86_64_WORD_SIZE;
+    printf("Process is not running\n");
+    return 0;
   }
-  if((length % X86_64_WORD_SIZE) != 0)
+  
+  mdbg->interrupt_requested = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  
+  while(1)
   {
-    memcpy(&block, curr, X86_64_WORD_SIZE);
-    SECURE_SCALL( (ptrace(PTRACE_POKEDATA, mdbg->traced_id, address + (c * X86_64_WORD_SIZE), block)) );
-  }  
-}
-
-static uint64_t get_register(unsigned int regaddr)
-{
-  uint64_t value;
+    address = get_register(RIP);
+    if(address != mdbg->curr->reported_bp && (bp = bptable_find(&mdbg->bpt, address)) != 0 && breakpoint_hit(bp))
+    {
+      ret = 1;
+      break;
+    }
+    
+    if(mdbg->interrupt_requested)
+    {
+      printf("Interrupted at %lx\n", address);
+      ret = 1;
+      break;
+    }
+    
+    if( (block_end = find_block_end(address, branch_text)) == 0)
+    {
+      printf("Cannot access memory at address %lx\n", address);
+      ret = 1;
+      break;
+    }
+    
+    if(block_end != address)
+    {
+      ret = run_to(block_end);
+      if(ret != 1 || !TRAP_STOP())
+	break;
+      
+      // The process has been stopped by a trap that isn't a breakpoint
+      stop_address = get_register(RIP);
+      if(stop_address != block_end && !detect_breakpoint(stop_address))
+	break;
+      
+      if((bp = bptable_find(&mdbg->bpt, stop_address)) != 0)
+      {
+	if(breakpoint_hit(bp))
+	  break;
+	mdbg->curr->reported_bp = stop_address;
+      }
+      
+      // A breakpoint inside the block: a new block starts from there
+      if(stop_address != block_end)
+	continue;
+    }
+    
+    print_address(address);
+    printf("-%lx: \t\t%s\n", block_end, branch_text);
+    counter++;
+    
+    if((ret = resume_process(PTRACE_SINGLESTEP)) != 1 || !TRAP_STOP())
+      break;
+  }
   
-  SECURE_SCALL( (value = ptrace(PTRACE_PEEKUSER, mdbg->traced_id, regaddr * X86_64_WORD_SIZE, NULL)) );
-  return value;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%lu blocks traced in %.3f s (%.0f blocks/s)\n", counter, elapsed, elapsed > 0 ? counter / elapsed : 0);
+  
+  return ret;
 }
 
-static void set_register(unsigned int regaddr, uint64_t value)
+int next_instruction(void)
 {
-  SECURE_SCALL(( ptrace(PTRACE_POKEUSER, mdbg->traced_id, regaddr * X86_64_WORD_SIZE, value) ));
+  struct breakpoint_data_restore *bp;
+  uint64_t address;
+  int ret;
+  
+  if(mdbg->curr->state_flags == FAULT)
+  {
+    printf("Process received a segmentation fault\n");
+    return 1;
+  }
+  
+  if(mdbg->curr->state_flags != INTERRUPTED)
+  {
+    printf("Process is not running\n");
+    return 0;
+  }
+  
+  if((ret = _next_instruction()) != 2)
+    return ret;
+  
+  //The instruction executed jumps on a breakpoint: the hit is counted now, so it will be only stepped over
+  address = get_register(RIP);
+  if((bp = bptable_find(&mdbg->bpt, address)) != 0)
+  {
+    breakpoint_hit(bp);
+    mdbg->curr->reported_bp = address;
+  }
+  
+  return 1;
+}
+
+/* Execute the next instruction. 
+ * Return 0 if the process terminates, 1 if it is stopped by a breakpoint or by a signal, 2 if the instruction has been executed
+ */
+int _next_instruction(void)
+{
+  struct breakpoint_data_restore *bp;
+  const struct decoded_instruction *di;
+  uint64_t address;
+  unsigned char instruction_traced[INSTRUCTION_MAX_SIZE];
+  int ret;
+  
+  address = get_register(RIP);
+  // A breakpoint reached by stepping is reported once, then the next step executes it
+  if(address != mdbg->curr->reported_bp && (bp = bptable_find(&mdbg->bpt, address)) != 0 && breakpoint_hit(bp))
+    return 1;
+  
+  // The instruction is read and decoded only the first time it is executed
+  if( (di = lookup_instruction(address)) == 0)
+  {
+    memset(instruction_traced, 0, INSTRUCTION_MAX_SIZE);
+    if(get_text(address, instruction_traced, INSTRUCTION_MAX_SIZE) <= 0)
+    {
+      printf("Cannot access memory at address %lx\n", address);
+      return 1;
+    }
+    di = decode_instruction(address, instruction_traced);
+  }
+  
+  print_address(address);
+  printf(": \t\t%s\n", di->text);
+  
+  if((ret = resume_process(PTRACE_SINGLESTEP)) != 1)
+    return ret;
+  if(!TRAP_STOP())
+    return 1;
+  
+  return 2;
+}
+
+void kill_process(void)
+{
+  pid_t pid;
+  int status;
+  
+  if(mdbg->curr->state_flags == DISABLED)
+    printf("The traced process is not running\n");
+  else
+  {
+    printf("Killing the traced process\n");
+    kill(mdbg->traced_id, SIGKILL);
+    // The exit of the main thread is reported after the ones of the other threads
+    while((pid = waitpid(-1, &status, __WALL)) != -1)
+      if(pid == mdbg->traced_id && (WIFEXITED(status) || WIFSIGNALED(status)))
+	break;
+    if(pid == -1)
+      printf("Traced process is in a zombie state because an error has occurred: %s\n", strerror(errno));
+    release_threads();
+    clean_debugger();
+  }
+}
+
+/* Remove all the traps and let the process run without the debugger. The held signals are delivered */
+void detach_process(void)
+{
+  struct thread_state *th;
+  unsigned int i;
+  pid_t pid;
+  
+  if(mdbg->curr->state_flags == DISABLED)
+  {
+    printf("The traced process is not running\n");
+    return;
+  }
+  
+  // Only a stopped thread can be detached
+  if(stop_all_threads() == 0)
+  {
+    clean_debugger();
+    return;
+  }
+  
+  delete_all_breakpoints();
+  
+  pid = mdbg->traced_id;
+  for(i = 0; i < mdbg->threads.size; i++)
+  {
+    if((th = mdbg->threads.slots[i]) == 0)
+      continue;
+    
+    // The rewound breakpoints moved RIP back
+    select_thread(th);
+    flush_registers();
+    ptrace(PTRACE_DETACH, th->tid, NULL, th->pending_signal);
+  }
+  
+  release_threads();
+  clean_debugger();
+  printf("Detached from process %d\n", pid);
+}
+
+void set_breakpoint(uint64_t address, int auto_continue)
+{
+  struct breakpoint_data_restore *curr;
+  unsigned char instruction;
+  
+  if(mdbg->curr->state_flags == FAULT)
+  {
+    printf("Process received a segmentation fault\n");
+    return;
+  }
+  
+  if(mdbg->curr->state_flags == DISABLED)
+  {
+    printf("The traced process is not running\n");
+    return;
+  }
+    
+  if(bptable_find(&mdbg->bpt, address) != 0)
+  {
+    printf("Breakpoint at %lx already exists\n", address);
+    return;
+  }
+  
+  if(get_data(address, &instruction, 1) != 1)
+  {
+    printf("Cannot access memory at address %lx\n", address);
+    return;
+  }
+  
+  curr = bptable_insert(&mdbg->bpt, address);
+  curr->orig_byte = instruction;
+  curr->auto_continue = auto_continue;
+  
+  insert_trap(curr);
+}
+
+void delete_breakpoint(uint64_t address)
+{
+  if(mdbg->curr->state_flags == DISABLED)
+  {
+    printf("The traced process is not running\n");
+    return;
+  }
+  
+  _delete_breakpoint(address);
+}
+
+void delete_all_breakpoints(void)
+{
+  struct text_patch *patches;
+  unsigned int i;
+  int n = 0;
+  
+  if(mdbg->curr->state_flags == DISABLED)
+  {
+    printf("The traced process is not running\n");
+    return;
+  }
+  
+  patches = malloc(sizeof(struct text_patch) * (mdbg->bpt.counter + 1));
+  for(i = 0; i < mdbg->bpt.size; i++)
+  {
+    if(mdbg->bpt.slots[i].address_at == 0)
+      continue;
+    patches[n].address = mdbg->bpt.slots[i].address_at;
+    patches[n].byte = mdbg->bpt.slots[i].orig_byte;
+    n++;
+  }
+  
+  write_patches(patches, n);
+  free(patches);
+  
+  bptable_clear(&mdbg->bpt);
+  mdbg->curr->reported_bp = 0;
+}
+
+void _delete_breakpoint(uint64_t address)
+{
+  struct breakpoint_data_restore *curr;
+  
+  if( (curr = bptable_find(&mdbg->bpt, address)) == 0)
+  {
+    printf("Breakpoint doesn't exist\n");
+    return;
+  }
+  
+  remove_trap(curr);
+  bptable_remove(&mdbg->bpt, address);
+}
+
+void ignore_breakpoint(uint64_t address, unsigned int count)
+{
+  struct breakpoint_data_restore *curr;
+  
+  if( (curr = bptable_find(&mdbg->bpt, address)) == 0)
+  {
+    printf("Breakpoint doesn't exist\n");
+    return;
+  }
+  
+  curr->ignore_count = count;
+  printf("Will ignore next %u crossings of breakpoint at %lx\n", count, address);
+}
+
+void print_breakpoints(void)
+{
+  struct breakpoint_data_restore *curr;
+  unsigned int i;
+  
+  if(mdbg->bpt.counter == 0)
+  {
+    printf("No breakpoints\n");
+    return;
+  }
+  
+  for(i = 0; i < mdbg->bpt.size; i++)
+  {
+    curr = mdbg->bpt.slots + i;
+    if(curr->address_at == 0)
+      continue;
+    
+    printf("%lx\thits: %lu", curr->address_at, curr->hits);
+    if(curr->ignore_count != 0)
+      printf("\tignore next %u", curr->ignore_count);
+    if(curr->auto_continue)
+      printf("\tauto-continue");
+    printf("\n");
+  }
+}
+
+int stack_trace(struct unwind_frame *frames, int max)
+{
+  if(mdbg->curr->state_flags != INTERRUPTED && mdbg->curr->state_flags != FAULT)
+    return -1;
+  
+  return unwind_stack(get_register(RIP), get_register(RSP), get_register(RBP), get_data, frames, max);
+}
+
+void print_backtrace(void)
+{
+  struct unwind_frame frames[UNWIND_MAX_FRAMES];
+  int n, i;
+  
+  if( (n = stack_trace(frames, UNWIND_MAX_FRAMES)) == -1)
+  {
+    printf("The traced process is not stopped\n");
+    return;
+  }
+  
+  for(i = 0; i < n; i++)
+  {
+    printf("#%-3d ", i);
+    print_address(frames[i].pc);
+    printf("\n");
+  }
+}
+
+ssize_t read_memory(uint64_t address, void *buffer, size_t length)
+{
+  if(mdbg->curr->state_flags == DISABLED)
+    return -1;
+  
+  return get_text(address, buffer, length);
+}
+
+uint64_t get_register_value(unsigned int index)
+{
+  if(mdbg->curr->state_flags == DISABLED)
+  {
+    printf("The traced process is not running\n");
+    return 0;
+  }
+  
+  return get_register(index);
+}
+
+const struct user_fpregs_struct *get_fp_registers(void)
+{
+  if(mdbg->curr->state_flags == DISABLED || mdbg->curr->state_flags == RUNNING)
+    return 0;
+  
+  if(!mdbg->fpregs_valid)
+  {
+    if(ptrace(PTRACE_GETFPREGS, mdbg->curr->tid, NULL, &mdbg->fpregs) == -1)
+      return 0;
+    mdbg->fpregs_valid = 1;
+  }
+  
+  return &mdbg->fpregs;
+}
+
+const unsigned char *get_xsave_state(size_t *size)
+{
+  struct iovec iov;
+  
+  if(mdbg->curr->state_flags == DISABLED || mdbg->curr->state_flags == RUNNING)
+    return 0;
+  
+  if(!mdbg->xstate_valid)
+  {
+    if(mdbg->xstate == 0)
+    {
+      mdbg->xstate_size = XSAVE_AREA_MAX_SIZE;
+      mdbg->xstate = malloc(mdbg->xstate_size);
+    }
+    
+    iov.iov_base = mdbg->xstate;
+    iov.iov_len = XSAVE_AREA_MAX_SIZE;
+    if(ptrace(PTRACE_GETREGSET, mdbg->curr->tid, NT_X86_XSTATE, &iov) == -1)
+      return 0;
+    // The kernel reports the size of the XSAVE area of this CPU
+    mdbg->xstate_size = iov.iov_len;
+    mdbg->xstate_valid = 1;
+  }
+  
+  *size = mdbg->xstate_size;
+  return mdbg->xstate;
+}
+
+static int detect_breakpoint(uint64_t address)
+{
+  return bptable_find(&mdbg->bpt, address) != 0;
+}
+
+void restore_after_breakpoint(uint64_t address)
+{
+  //Restore the RIP register after the breakpoint instruction. The trap stays armed: it is stepped over on the next resume
+  set_register(RIP, address);
+}
+
+/* Count a hit on bp. Return 1 if the process has to stop (the breakpoint is reported), 0 if the execution goes on */
+static int breakpoint_hit(struct breakpoint_data_restore *bp)
+{
+  bp->hits++;
+  mdbg->curr->bp_rewound = 0;
+  
+  if(bp->ignore_count != 0)
+  {
+    bp->ignore_count--;
+    return 0;
+  }
+  
+  if(bp->auto_continue)
+    return 0;
+  
+  printf("Breakpoint at ");
+  print_address(bp->address_at);
+  printf(" (hit %lu)\n", bp->hits);
+  mdbg->curr->reported_bp = bp->address_at;
+  
+  return 1;
+}
+
+static void insert_trap(struct breakpoint_data_restore *bp)
+{
+  unsigned char trap = TRAP_INSTRUCTION;
+  
+  set_text(bp->address_at, &trap, 1);
+}
+
+static void remove_trap(struct breakpoint_data_restore *bp)
+{
+  set_text(bp->address_at, &bp->orig_byte, 1);
+}
+
+static int compare_patches(const void *a, const void *b)
+{
+  const struct text_patch *pa = a, *pb = b;
+  
+  return (pa->address > pb->address) - (pa->address < pb->address);
+}
+
+/* Write a set of single byte patches. The patches sharing one aligned word are merged in a single read-modify-write */
+static void write_patches(struct text_patch *patches, int n)
+{
+  uint64_t word_address;
+  unsigned char word[X86_64_WORD_SIZE];
+  int i, j;
+  
+  qsort(patches, n, sizeof(struct text_patch), compare_patches);
+  
+  for(i = 0; i < n; i = j)
+  {
+    word_address = patches[i].address & ~(X86_64_WORD_SIZE - 1);
+    for(j = i + 1; j < n && (patches[j].address & ~(X86_64_WORD_SIZE - 1)) == word_address; j++)
+      ;
+    
+    if(j - i == 1)
+    {
+      set_text(patches[i].address, &patches[i].byte, 1);
+      continue;
+    }
+    
+    // An aligned word never crosses a page, so it is read and written whole
+    if(get_data(word_address, word, X86_64_WORD_SIZE) != X86_64_WORD_SIZE)
+      continue;
+    for(; i < j; i++)
+      word[patches[i].address - word_address] = patches[i].byte;
+    set_text(word_address, word, X86_64_WORD_SIZE);
+  }
+}
+
+/* Replace the traps inside [address, address + length) with the original bytes, so the reads show the real code */
+static void shadow_breakpoints(uint64_t address, unsigned char *buffer, size_t length)
+{
+  struct breakpoint_data_restore *bp;
+  unsigned int i;
+  size_t c;
+  
+  if(mdbg->bpt.counter == 0)
+    return;
+  
+  // Short ranges (instructions) probe the table for every byte, long ranges scan the table once
+  if(length <= mdbg->bpt.size)
+  {
+    for(c = 0; c < length; c++)
+      if(buffer[c] == TRAP_INSTRUCTION && (bp = bptable_find(&mdbg->bpt, address + c)) != 0)
+	buffer[c] = bp->orig_byte;
+  }
+  else
+  {
+    for(i = 0; i < mdbg->bpt.size; i++)
+    {
+      bp = mdbg->bpt.slots + i;
+      if(bp->address_at >= address && bp->address_at - address < length)
+	buffer[bp->address_at - address] = bp->orig_byte;
+    }
+  }
+}
+
+/* Resume the traced process with request (PTRACE_CONT or PTRACE_SINGLESTEP) and wait for it.
+ * If the process is stopped on a breakpoint, its original instruction is executed first.
+ */
+static int resume_process(int request)
+{
+  int ret;
+  
+  if((ret = resume_nowait(request)) != -1)
+    return ret;
+  
+  return wait_process();
+}
+
+/* Resume the process as resume_process() without waiting for it. 
+ * Return -1 if the process is running, otherwise the process stopped while the breakpoint was stepped over (returns as wait_process())
+ */
+static int resume_nowait(int request)
+{
+  uint64_t address;
+  int ret;
+  
+  mdbg->curr->reported_bp = 0;
+  
+  // A breakpoint not counted yet is executed again
+  address = get_register(RIP);
+  if(detect_breakpoint(address) && !mdbg->curr->bp_rewound)
+  {
+    ret = step_over_breakpoint(address);
+    if(ret != 1 || request == PTRACE_SINGLESTEP || !TRAP_STOP())
+      return ret;
+  }
+  
+  ptrace_resume(request);
+  
+  return -1;
+}
+
+/* Handle a stop of a process resumed by continue. 
+ * Return 2 if it has to be resumed again (ignored or auto-continue breakpoint), otherwise returns as wait_process()
+ */
+static int continue_stop(int ret)
+{
+  struct breakpoint_data_restore *bp;
+  uint64_t address;
+  
+  //If traced process has been interrupted by a SIGTRAP checks if a breakpoint has occurred
+  if(ret != 1 || mdbg->curr->last_signal != SIGTRAP || mdbg->curr->last_event != 0)
+    return ret;
+  
+  //The last instruction executed at one byte first, is it INT3 ?
+  address = get_register(RIP);
+  address -= 1;
+  if( (bp = bptable_find(&mdbg->bpt, address)) == 0)
+    return ret;
+  
+  restore_after_breakpoint(address);
+  if(breakpoint_hit(bp))
+    return 1;
+  
+  if(mdbg->interrupt_requested)
+  {
+    printf("Interrupted at %lx\n", address);
+    return 1;
+  }
+  
+  return 2;
+}
+
+/* Decode forward from address up to the first control transfer instruction and copy its text in branch_text.
+ * Return its address (or the address where the decoding stopped if the block is too long), 0 if the code can't be read.
+ */
+static uint64_t find_block_end(uint64_t address, char *branch_text)
+{
+  const struct decoded_instruction *di;
+  unsigned char code[BLOCK_READ_SIZE];
+  uint64_t base = 0;
+  ssize_t available = 0;
+  int i;
+  
+  for(i = 0; i < BLOCK_MAX_INSTRUCTIONS; i++)
+  {
+    if( (di = lookup_instruction(address)) == 0)
+    {
+      // The code is read in chunks, not per instruction
+      if(address < base || address + INSTRUCTION_MAX_SIZE > base + available)
+      {
+	memset(code, 0, BLOCK_READ_SIZE);
+	base = address;
+	if((available = get_text(address, code, BLOCK_READ_SIZE)) <= 0)
+	  return 0;
+      }
+      di = decode_instruction(address, code + (address - base));
+    }
+    
+    if(di->length <= 0)
+      return 0;
+    
+    if(di->flow != FLOW_NONE)
+    {
+      strcpy(branch_text, di->text);
+      return address;
+    }
+    
+    address += di->length;
+  }
+  
+  strcpy(branch_text, "(block too long)");
+  return address;
+}
+
+/* Continue the process up to address with a temporary trap. 
+ * The trap is removed as soon as the process stops, and if it has been reached RIP is moved back on address.
+ */
+static int run_to(uint64_t address)
+{
+  unsigned char orig, trap = TRAP_INSTRUCTION;
+  int temporary, ret;
+  
+  // A breakpoint is already there
+  temporary = !detect_breakpoint(address);
+  if(temporary)
+  {
+    if(get_data(address, &orig, 1) != 1)
+      return 1;
+    set_text(address, &trap, 1);
+  }
+  
+  ret = resume_process(PTRACE_CONT);
+  
+  if(temporary && ret == 1)
+    set_text(address, &orig, 1);
+  
+  if(ret == 1 && mdbg->curr->last_signal == SIGTRAP && (detect_breakpoint(get_register(RIP) - 1) || (temporary && get_register(RIP) - 1 == address)))
+    restore_after_breakpoint(get_register(RIP) - 1);
+  
+  return ret;
+}
+
+/* Log the registers changed by the last executed instruction (RIP excluded) and update prev */
+static void log_register_deltas(struct user_regs_struct *prev)
+{
+  uint64_t *curr, *old;
+  unsigned int i;
+  
+  get_register(RIP);
+  curr = (uint64_t*)&mdbg->curr->regs;
+  old = (uint64_t*)prev;
+  
+  for(i = 0; i < sizeof(struct user_regs_struct) / X86_64_WORD_SIZE; i++)
+    if(i != RIP && curr[i] != old[i])
+      tracelog_reg(i, curr[i]);
+  
+  *prev = mdbg->curr->regs;
+}
+
+/* Single-step the original instruction at a breakpoint address and then re-insert the trap */
+static int step_over_breakpoint(uint64_t address)
+{
+  struct breakpoint_data_restore *bp;
+  int ret;
+  
+  bp = bptable_find(&mdbg->bpt, address);
+  remove_trap(bp);
+  
+  ptrace_resume(PTRACE_SINGLESTEP);
+  
+  if((ret = wait_process()) == 1)
+    insert_trap(bp);
+  
+  return ret;
+}
+
+/* Wait for the selected thread and control its exited status. 
+ * Return 0 if the process terminates the execution, 1 if the process is stopped by a signal (usually a SIGTRAP) or a segmentation fault was occurred
+ */
+static int wait_process(void)
+{
+  if(mdbg->curr->state_flags != RUNNING)
+  {
+    /* WARNING: This conditional statement should not never becomes true, otherwise abort the process */
+    
+    printf("Error code 001 (The process is not running).\n");
+    abort();
+  }
+  
+  return wait_event(mdbg->curr->tid, 0);
+}
+
+/* Wait for the next event of the thread tid (-1 for any thread) and select it. 
+ * The thread creations and exits are handled here, the stops of the other threads are held (see hold_thread()).
+ * Return -1 if nohang and there is nothing to report, otherwise as wait_process()
+ */
+static int wait_event(pid_t tid, int nohang)
+{
+  struct thread_state *th, *child;
+  unsigned long new_tid;
+  int status = 0;
+  pid_t pid;
+  
+  while(1)
+  {
+    /* The threads are checked before sleeping: a SIGCHLD received meanwhile stays pending in the signalfd. 
+     * A Ctrl-C while waiting interrupts the traced process (PTRACE_INTERRUPT)
+     */
+    if((pid = waitpid(-1, &status, WNOHANG | __WALL)) == 0)
+    {
+      if(nohang)
+	return -1;
+      if(event_wait(0) == EVENT_INTERRUPT)
+	interrupt_process();
+      continue;
+    }
+    
+    if(pid == -1)
+    {
+      if(errno == EINTR)
+	continue;
+      
+      /* WARNING: this conditional statement should not never becomes true, otherwise abort the process */
+      
+      fprintf(stderr, "%s\n", strerror(errno));
+      if(errno != ECHILD)
+	kill(mdbg->traced_id, SIGTERM);
+      
+      abort();
+    }
+    
+    // The first stop of a new thread can be reported before the clone event of its parent
+    if((th = thtable_find(&mdbg->threads, pid)) == 0)
+    {
+      th = add_thread(pid);
+      th->state_flags = RUNNING;
+      th->starting = 1;
+    }
+    
+    // The main thread exits as last: it's the end of the process (process_status())
+    if((WIFEXITED(status) || WIFSIGNALED(status)) && pid != mdbg->traced_id)
+    {
+      remove_thread(th);
+      if(pid != tid)
+	continue;
+      printf("Thread %d exited\n", pid);
+      return 1;
+    }
+    
+    // The parent goes on with its last request (a step over the clone syscall too)
+    if(WIFSTOPPED(status) && (status >> 16) == PTRACE_EVENT_CLONE)
+    {
+      if(ptrace(PTRACE_GETEVENTMSG, pid, NULL, &new_tid) != -1 && (child = add_thread(new_tid)) != 0)
+      {
+	child->state_flags = RUNNING;
+	child->starting = 1;
+      }
+      SECURE_SCALL( ptrace(th->resume_request, pid, NULL, NULL) );
+      continue;
+    }
+    
+    if(WIFSTOPPED(status) && (status >> 16) == PTRACE_EVENT_STOP && WSTOPSIG(status) == SIGTRAP)
+    {
+      // Late stop of an all-stop interrupt: the thread was already stopped, the last request is repeated
+      if(th->interrupt_pending)
+      {
+	th->interrupt_pending = 0;
+	SECURE_SCALL( ptrace(th->resume_request, pid, NULL, NULL) );
+	continue;
+      }
+      
+      // A new thread runs only if the other threads are running too
+      if(th->starting)
+      {
+	th->starting = 0;
+	if(tid == -1 || mdbg->non_stop)
+	  SECURE_SCALL( ptrace(PTRACE_CONT, pid, NULL, NULL) );
+	else
+	  hold_thread(th, status);
+	continue;
+      }
+    }
+    
+    if(tid != -1 && pid != tid)
+    {
+      hold_thread(th, status);
+      continue;
+    }
+    
+    select_thread(th);
+    return process_status(status);
+  }
+}
+
+/* Update the state of the selected thread with the status returned by waitpid */
+static int process_status(int status)
+{
+  mdbg->curr->last_signal = WIFSTOPPED(status) ? WSTOPSIG(status) : 0;
+  mdbg->curr->last_event = WIFSTOPPED(status) ? (status >> 16) : 0;
+  
+  //The traced process was terminated normally.
+  if(WIFEXITED(status))
+  {
+    printf("The process is terminated with code %d\n", WEXITSTATUS(status));
+    release_threads();
+    return 0;
+  }
+  
+  //The traced process was terminated by a signal that it was not caught
+  if(WIFSIGNALED(status))
+  {
+    printf("The process is terminated by signal %s\n", strsignal(WTERMSIG(status)));
+    release_threads();
+    return 0;
+  }
+  
+  //A segmentation fault has occurred in the traced process, so it is currently stopped
+  if(WIFSTOPPED(status) && (WSTOPSIG(status) == SIGSEGV) && mdbg->curr->last_event == 0)
+  {
+    mdbg->curr->state_flags = FAULT;
+    printf("Segmentation fault :(\n");
+    return 1;
+  }
+
+  mdbg->curr->state_flags = INTERRUPTED;
+  
+  //The process has been stopped by PTRACE_INTERRUPT or by a stop signal (group-stop)
+  if(mdbg->curr->last_event == PTRACE_EVENT_STOP)
+  {
+    if(mdbg->curr->last_signal == SIGTRAP)
+      printf("Interrupted at %lx\n", get_register(RIP));
+    else
+      printf("The process is stopped by a %s signal\n", strsignal(mdbg->curr->last_signal));
+    return 1;
+  }
+  
+  if(mdbg->curr->last_event == PTRACE_EVENT_EXEC)
+  {
+    printf("The process has executed a new program\n");
+    symbols_open(mdbg->traced_id);
+    unwind_reset();
+    return 1;
+  }
+  
+  //if the process was interrupted by a signal then print the signal, it's delivered when the thread is resumed
+  if(WIFSTOPPED(status) && (WSTOPSIG(status) != SIGTRAP))
+  {
+    printf("The process receive a %s signal\n", strsignal(WSTOPSIG(status)));
+    if(WSTOPSIG(status) != SIGINT && WSTOPSIG(status) != SIGSTOP)
+      mdbg->curr->pending_signal = WSTOPSIG(status);
+  }
+
+  return 1;
+}
+
+/* Opens /proc/<pid>/mem: it is used to write the read-only pages (text) and as fallback when process_vm_* are not available */
+static void open_memory(void)
+{
+  char path[32];
+  
+  snprintf(path, sizeof(path), "/proc/%d/mem", mdbg->traced_id);
+  mdbg->mem_fd = open(path, O_RDWR | O_CLOEXEC);
+}
+
+static void close_memory(void)
+{
+  if(mdbg->mem_fd != -1)
+    close(mdbg->mem_fd);
+  mdbg->mem_fd = -1;
+}
+
+/* Read length bytes at address of the traced process. 
+ * Return the number of bytes read: it's less than length if the range crosses an unmapped page, -1 if nothing could be read
+ */
+static ssize_t get_data(uint64_t address, void *wbuffer, size_t length)
+{
+  struct iovec local, remote;
+  ssize_t ret;
+  
+  if(!vm_rw_unsupported)
+  {
+    local.iov_base = wbuffer;
+    local.iov_len = length;
+    remote.iov_base = (void*)address;
+    remote.iov_len = length;
+    
+    if((ret = process_vm_readv(mdbg->traced_id, &local, 1, &remote, 1, 0)) != -1)
+      return ret;
+    if(errno == EFAULT)
+      return -1;
+    if(errno == ENOSYS)
+      vm_rw_unsupported = 1;
+  }
+  
+  if(mdbg->mem_fd != -1)
+  {
+    if((ret = pread(mdbg->mem_fd, wbuffer, length, address)) != -1)
+      return ret;
+    if(errno == EIO || errno == EFAULT)
+      return -1;
+  }
+  
+  return peek_data(address, wbuffer, length);
+}
+
+/* Write length bytes at address of the traced process. The read-only pages are written through /proc/<pid>/mem.
+ * Return the number of bytes written or -1 on error
+ */
+static ssize_t set_data(uint64_t address, const void *rbuffer, size_t length)
+{
+  struct iovec local, remote;
+  ssize_t ret = 0, wret;
+  
+  // The code could be changed: the decoded instructions of these pages are discarded
+  invalidate_instructions(address, length);
+  
+  if(!vm_rw_unsupported)
+  {
+    local.iov_base = (void*)rbuffer;
+    local.iov_len = length;
+    remote.iov_base = (void*)address;
+    remote.iov_len = length;
+    
+    if((ret = process_vm_writev(mdbg->traced_id, &local, 1, &remote, 1, 0)) == length)
+      return ret;
+    if(ret == -1 && errno == ENOSYS)
+      vm_rw_unsupported = 1;
+    
+    // A read-only page stopped the write: the remaining bytes are written below
+    if(ret > 0)
+    {
+      address += ret;
+      rbuffer = (const char*)rbuffer + ret;
+      length -= ret;
+    }
+    else
+      ret = 0;
+  }
+  
+  if(mdbg->mem_fd != -1)
+  {
+    if((wret = pwrite(mdbg->mem_fd, rbuffer, length, address)) != -1)
+      return ret + wret;
+    if(errno == EIO || errno == EFAULT)
+      return ret ? ret : -1;
+  }
+  
+  if((wret = poke_data(address, rbuffer, length)) == -1)
+    return ret ? ret : -1;
+  
+  return ret + wret;
+}
+
+/* Read the memory as get_data() but the breakpoints are hidden by the original bytes */
+static ssize_t get_text(uint64_t address, void *wbuffer, size_t length)
+{
+  ssize_t ret;
+  
+  if((ret = get_data(address, wbuffer, length)) > 0)
+    shadow_breakpoints(address, wbuffer, ret);
+  
+  return ret;
+}
+
+/* Write the text of the process. The text pages are read-only, so /proc/<pid>/mem is used directly instead of trying process_vm_writev first.
+ * It's used for the traps only: they are hidden to the reads, so the decoded instructions are still valid.
+ */
+static ssize_t set_text(uint64_t address, const void *rbuffer, size_t length)
+{
+  ssize_t ret;
+  
+  if(mdbg->mem_fd != -1 && (ret = pwrite(mdbg->mem_fd, rbuffer, length, address)) == length)
+    return ret;
+  
+  return set_data(address, rbuffer, length);
+}
+
+/* Word-wise fallback on PTRACE_PEEKDATA */
+static ssize_t peek_data(uint64_t address, void *wbuffer, size_t length)
+{
+  char *curr = (char*)wbuffer;
+  size_t done = 0, chunk;
+  uint64_t block;
+  
+  while(done < length)
+  {
+    errno = 0;
+    block = ptrace(PTRACE_PEEKDATA, mdbg->curr->tid, address + done, NULL);
+    if(errno != 0)
+      return done ? done : -1;
+    
+    chunk = (length - done) < X86_64_WORD_SIZE ? (length - done) : X86_64_WORD_SIZE;
+    memcpy(curr + done, &block, chunk);
+    done += chunk;
+  }
+  
+  return done;
+}
+
+/* Word-wise fallback on PTRACE_POKEDATA. A trailing partial word is merged with the current memory content */
+static ssize_t poke_data(uint64_t address, const void *rbuffer, size_t length)
+{
+  const char *curr = (const char*)rbuffer;
+  size_t done = 0, chunk;
+  uint64_t block = 0;
+  
+  while(done < length)
+  {
+    chunk = (length - done) < X86_64_WORD_SIZE ? (length - done) : X86_64_WORD_SIZE;
+    if(chunk < X86_64_WORD_SIZE)
+    {
+      errno = 0;
+      block = ptrace(PTRACE_PEEKDATA, mdbg->curr->tid, address + done, NULL);
+      if(errno != 0)
+	return done ? done : -1;
+    }
+    
+    memcpy(&block, curr + done, chunk);
+    if(ptrace(PTRACE_POKEDATA, mdbg->curr->tid, address + done, block) == -1)
+      return done ? done : -1;
+    done += chunk;
+  }
+  
+  return done;
+}
+
+static uint64_t get_register(unsigned int regaddr)
+{
+  if(!mdbg->curr->regs_valid)
+    load_registers();
+  
+  return ((uint64_t*)&mdbg->curr->regs)[regaddr];
+}
+
+static void set_register(unsigned int regaddr, uint64_t value)
+{
+  if(!mdbg->curr->regs_valid)
+    load_registers();
+  
+  ((uint64_t*)&mdbg->curr->regs)[regaddr] = value;
+  mdbg->curr->regs_dirty = 1;
+}
+
+/* Read all the general purpose registers with a single PTRACE_GETREGS */
+static void load_registers(void)
+{
+  SECURE_SCALL( ptrace(PTRACE_GETREGS, mdbg->curr->tid, NULL, &mdbg->curr->regs) );
+  mdbg->curr->regs_valid = 1;
+}
+
+/* Write back the modified registers with a single PTRACE_SETREGS */
+static void flush_registers(void)
+{
+  if(!mdbg->curr->regs_dirty)
+    return;
+  
+  SECURE_SCALL( ptrace(PTRACE_SETREGS, mdbg->curr->tid, NULL, &mdbg->curr->regs) );
+  mdbg->curr->regs_dirty = 0;
+}
+
+static void invalidate_registers(void)
+{
+  mdbg->curr->regs_valid = 0;
+  mdbg->curr->regs_dirty = 0;
+  mdbg->fpregs_valid = 0;
+  mdbg->xstate_valid = 0;
+}
+
+/* Flush the registers cache and resume the selected thread with request. A pending signal is delivered */
+static void ptrace_resume(int request)
+{
+  flush_registers();
+  invalidate_registers();
+  
+  mdbg->curr->state_flags = RUNNING;
+  mdbg->curr->resume_request = request;
+  SECURE_SCALL( ptrace(request, mdbg->curr->tid, NULL, mdbg->curr->pending_signal) );
+  mdbg->curr->pending_signal = 0;
+}
+
+/* Record the stop of a thread that isn't reported to the user (all-stop or an event while another thread is waited for).
+ * A breakpoint hit is rewound, so the trap is executed and counted again on resume. A signal is delivered on resume.
+ */
+static void hold_thread(struct thread_state *th, int status)
+{
+  th->state_flags = INTERRUPTED;
+  th->last_signal = WSTOPSIG(status);
+  th->last_event = status >> 16;
+  
+  if(th->last_event == PTRACE_EVENT_STOP)
+  {
+    if(th->last_signal == SIGTRAP)
+      th->interrupt_pending = 0;
+    return;
+  }
+  
+  if(th->last_event != 0)
+    return;
+  
+  if(th->last_signal != SIGTRAP)
+  {
+    if(th->last_signal != SIGINT && th->last_signal != SIGSTOP)
+      th->pending_signal = th->last_signal;
+    return;
+  }
+  
+  SECURE_SCALL( ptrace(PTRACE_GETREGS, th->tid, NULL, &th->regs) );
+  th->regs_valid = 1;
+  if(detect_breakpoint(th->regs.rip - 1))
+  {
+    th->regs.rip--;
+    th->regs_dirty = 1;
+    th->bp_rewound = 1;
+  }
+}
+
+/* All-stop mode: interrupt the running threads and wait for their stop. Return 0 if the process terminated meanwhile, otherwise 1.
+ * It costs a few syscalls per thread, but only when a stop is reported to the user: the auto-continue breakpoints don't stop the other threads.
+ */
+static int stop_all_threads(void)
+{
+  struct thread_state *th, *child;
+  unsigned long new_tid;
+  pid_t *tids, pid;
+  int n, i, status;
+  
+  // The clone events add new threads to stop
+  while((tids = running_threads(&n)) != 0)
+  {
+    // The new threads stop by themselves
+    for(i = 0; i < n; i++)
+    {
+      th = thtable_find(&mdbg->threads, tids[i]);
+      if(!th->starting && ptrace(PTRACE_INTERRUPT, th->tid, NULL, NULL) != -1)
+	th->interrupt_pending = 1;
+    }
+    
+    for(i = 0; i < n; i++)
+    {
+      th = thtable_find(&mdbg->threads, tids[i]);
+      while((pid = waitpid(th->tid, &status, __WALL)) == -1 && errno == EINTR)
+	;
+      
+      // The main thread is the last of the list: its exit is reported when the other threads are gone
+      if(pid != -1 && th->tid == mdbg->traced_id && (WIFEXITED(status) || WIFSIGNALED(status)))
+      {
+	free(tids);
+	select_thread(th);
+	return process_status(status);
+      }
+      
+      if(pid == -1 || WIFEXITED(status) || WIFSIGNALED(status))
+      {
+	remove_thread(th);
+	continue;
+      }
+      
+      if((status >> 16) == PTRACE_EVENT_CLONE)
+      {
+	if(ptrace(PTRACE_GETEVENTMSG, th->tid, NULL, &new_tid) != -1 && (child = add_thread(new_tid)) != 0)
+	{
+	  child->state_flags = RUNNING;
+	  child->starting = 1;
+	}
+      }
+      
+      th->starting = 0;
+      hold_thread(th, status);
+    }
+    
+    free(tids);
+  }
+  
+  return 1;
+}
+
+/* Resume all the stopped threads with PTRACE_CONT, the selected one as last: the threads held while a breakpoint was stepped over run again.
+ * Return as resume_nowait() for the selected thread
+ */
+static int resume_all(void)
+{
+  struct thread_state *prev = mdbg->curr, *th;
+  unsigned int i;
+  pid_t *tids;
+  int n = 0, j;
+  
+  tids = malloc(sizeof(pid_t) * mdbg->threads.counter);
+  for(i = 0; i < mdbg->threads.size; i++)
+    if((th = mdbg->threads.slots[i]) != 0 && th != prev && th->state_flags == INTERRUPTED)
+      tids[n++] = th->tid;
+  
+  for(j = 0; j < n; j++)
+  {
+    // A thread can exit while another one steps over a breakpoint
+    if((th = thtable_find(&mdbg->threads, tids[j])) == 0 || th->state_flags != INTERRUPTED)
+      continue;
+    
+    select_thread(th);
+    /* The registers aren't read to look for a breakpoint: a thread not reported on a breakpoint can be there only 
+     * if it has been interrupted before the trap, and the trap is executed (and counted) on resume
+     */
+    if(th->reported_bp != 0 || th->regs_valid)
+      resume_nowait(PTRACE_CONT);
+    else
+      ptrace_resume(PTRACE_CONT);
+  }
+  free(tids);
+  
+  select_thread(prev);
+  if(prev->state_flags != INTERRUPTED)
+    return -1;
+  
+  return resume_nowait(PTRACE_CONT);
+}
+
+/* Return the (allocated) list of the running threads and its size, or 0 if no thread is running. The main thread is the last one */
+static pid_t *running_threads(int *n)
+{
+  struct thread_state *th;
+  unsigned int i;
+  pid_t *tids;
+  int j;
+  
+  tids = malloc(sizeof(pid_t) * mdbg->threads.counter);
+  *n = 0;
+  for(i = 0; i < mdbg->threads.size; i++)
+    if((th = mdbg->threads.slots[i]) != 0 && th->state_flags == RUNNING)
+      tids[(*n)++] = th->tid;
+  
+  if(*n == 0)
+  {
+    free(tids);
+    return 0;
+  }
+  
+  for(j = 0; j < *n - 1; j++)
+    if(tids[j] == mdbg->traced_id)
+    {
+      tids[j] = tids[*n - 1];
+      tids[*n - 1] = mdbg->traced_id;
+    }
+  
+  return tids;
+}
+
+/* Add a thread of the traced process (stopped). Return 0 if it's already known */
+static struct thread_state *add_thread(pid_t tid)
+{
+  struct thread_state *th;
+  
+  if((th = thtable_insert(&mdbg->threads, tid)) != 0)
+    th->resume_request = PTRACE_CONT;
+  
+  return th;
+}
+
+/* Remove an exited thread. If it's the selected one the main thread is selected */
+static void remove_thread(struct thread_state *th)
+{
+  struct thread_state *leader;
+  
+  if(mdbg->curr == th)
+  {
+    leader = thtable_find(&mdbg->threads, mdbg->traced_id);
+    select_thread(leader != 0 && leader != th ? leader : &mdbg->no_thread);
+  }
+  
+  thtable_remove(&mdbg->threads, th->tid);
+}
+
+/* Forget all the threads: the process is terminated */
+static void release_threads(void)
+{
+  thtable_clear(&mdbg->threads);
+  memset(&mdbg->no_thread, 0, sizeof(struct thread_state));
+  select_thread(&mdbg->no_thread);
+}
+
+/* The floating point registers cache belongs to the selected thread */
+static void select_thread(struct thread_state *th)
+{
+  if(mdbg->curr == th)
+    return;
+  
+  mdbg->curr = th;
+  mdbg->fpregs_valid = 0;
+  mdbg->xstate_valid = 0;
+}
+
+static void report_thread_switch(pid_t prev)
+{
+  if(mdbg->curr->tid != prev && mdbg->curr->state_flags != DISABLED)
+    printf("[Switching to thread %d]\n", mdbg->curr->tid);
+}
+
+static int compare_tids(const void *a, const void *b)
+{
+  return *(const pid_t*)a - *(const pid_t*)b;
+}
+
+/* Seize the threads of pid that aren't traced yet. Return how many threads have been seized */
+static int seize_threads(pid_t pid)
+{
+  struct thread_state *th;
+  struct dirent *entry;
+  char path[32];
+  DIR *dir;
+  pid_t tid;
+  int n = 0;
+  
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  if((dir = opendir(path)) == 0)
+    return 0;
+  
+  while((entry = readdir(dir)) != 0)
+  {
+    if((tid = atoi(entry->d_name)) <= 0 || thtable_find(&mdbg->threads, tid) != 0)
+      continue;
+    
+    // The thread could be exited meanwhile
+    if(ptrace(PTRACE_SEIZE, tid, NULL, TRACE_OPTIONS) == -1)
+      continue;
+    
+    th = add_thread(tid);
+    th->state_flags = RUNNING;
+    n++;
+  }
+  
+  closedir(dir);
+  
+  return n;
 }
 
+/* Profiler tick: stop all the threads, record their call stacks and resume them. 
+ * Return 0 if the process terminated, otherwise as resume_all() (the stops of the threads are handled as by continue)
+ */
+static int sample_threads(void)
+{
+  struct unwind_frame frames[UNWIND_MAX_FRAMES];
+  struct thread_state *prev, *th;
+  unsigned int i;
+  int n;
+  
+  if(stop_all_threads() == 0)
+    return 0;
+  
+  prev = mdbg->curr;
+  for(i = 0; i < mdbg->threads.size; i++)
+  {
+    if((th = mdbg->threads.slots[i]) == 0 || th->state_flags != INTERRUPTED)
+      continue;
+    
+    select_thread(th);
+    if((n = stack_trace(frames, UNWIND_MAX_FRAMES)) <= 0)
+      continue;
+    profile_add(frames, n);
+    
+    // Interrupted on a breakpoint before its trap: the trap is executed (and counted) on resume
+    if(th->last_event == PTRACE_EVENT_STOP && th->reported_bp == 0 && detect_breakpoint(frames[0].pc))
+      th->bp_rewound = 1;
+  }
+  select_thread(prev);
+  
+  return resume_all();
+}
 
+/* Print address followed by symbol+offset, if the symbol is known */
+static void print_address(uint64_t address)
+{
+  const char *name;
+  uint64_t offset;
+  
+  if((name = symbol_name(address, &offset)) == 0)
+    printf("%lx", address);
+  else if(offset == 0)
+    printf("%lx <%s>", address, name);
+  else
+    printf("%lx <%s+0x%lx>", address, name, offset);
+}
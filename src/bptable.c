@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bptable.h"
+
+
+#define BPTABLE_INIT_SIZE	64
+// The table grows when it is filled at 70%
+#define BPTABLE_OVERLOADED(_bpt)	(((_bpt)->counter + 1) * 10 > (_bpt)->size * 7)
+
+
+static inline unsigned int bptable_hash(const struct breakpoint_table *bpt, uint64_t address)
+{
+  // Fibonacci hashing: the multiplication spreads the near addresses of the text segment
+  return (unsigned int)((address * 0x9e3779b97f4a7c15ULL) >> 32) & (bpt->size - 1);
+}
+
+static void bptable_resize(struct breakpoint_table *bpt, unsigned int size)
+{
+  struct breakpoint_data_restore *old = bpt->slots;
+  unsigned int old_size = bpt->size, i, h;
+  
+  bpt->slots = calloc(size, sizeof(struct breakpoint_data_restore));
+  bpt->size = size;
+  
+  for(i = 0; i < old_size; i++)
+  {
+    if(old[i].address_at == 0)
+      continue;
+    
+    h = bptable_hash(bpt, old[i].address_at);
+    while(bpt->slots[h].address_at != 0)
+      h = (h + 1) & (size - 1);
+    bpt->slots[h] = old[i];
+  }
+  
+  free(old);
+}
+
+void bptable_init(struct breakpoint_table *bpt)
+{
+  bpt->slots = calloc(BPTABLE_INIT_SIZE, sizeof(struct breakpoint_data_restore));
+  bpt->size = BPTABLE_INIT_SIZE;
+  bpt->counter = 0;
+}
+
+void bptable_destroy(struct breakpoint_table *bpt)
+{
+  free(bpt->slots);
+  bpt->slots = 0;
+  bpt->size = 0;
+  bpt->counter = 0;
+}
+
+void bptable_clear(struct breakpoint_table *bpt)
+{
+  memset(bpt->slots, 0, sizeof(struct breakpoint_data_restore) * bpt->size);
+  bpt->counter = 0;
+}
+
+struct breakpoint_data_restore *bptable_find(struct breakpoint_table *bpt, uint64_t address)
+{
+  unsigned int h;
+  
+  if(address == 0)
+    return 0;
+  
+  h = bptable_hash(bpt, address);
+  while(bpt->slots[h].address_at != 0)
+  {
+    if(bpt->slots[h].address_at == address)
+      return bpt->slots + h;
+    h = (h + 1) & (bpt->size - 1);
+  }
+  
+  return 0;
+}
+
+struct breakpoint_data_restore *bptable_insert(struct breakpoint_table *bpt, uint64_t address)
+{
+  unsigned int h;
+  
+  if(address == 0)
+    return 0;
+  
+  if(BPTABLE_OVERLOADED(bpt))
+    bptable_resize(bpt, bpt->size * 2);
+  
+  h = bptable_hash(bpt, address);
+  while(bpt->slots[h].address_at != 0)
+  {
+    if(bpt->slots[h].address_at == address)
+      return 0;
+    h = (h + 1) & (bpt->size - 1);
+  }
+  
+  memset(bpt->slots + h, 0, sizeof(struct breakpoint_data_restore));
+  bpt->slots[h].address_at = address;
+  bpt->counter++;
+  
+  return bpt->slots + h;
+}
+
+int bptable_remove(struct breakpoint_table *bpt, uint64_t address)
+{
+  struct breakpoint_data_restore *slot;
+  unsigned int hole, curr, h, mask = bpt->size - 1;
+  
+  if( (slot = bptable_find(bpt, address)) == 0)
+    return 0;
+  
+  /* Backward shift deletion: moves back the following entries of the probe sequence, so no tombstones are needed */
+  hole = slot - bpt->slots;
+  curr = (hole + 1) & mask;
+  while(bpt->slots[curr].address_at != 0)
+  {
+    h = bptable_hash(bpt, bpt->slots[curr].address_at);
+    // The entry can fill the hole only if its home slot is not in (hole, curr]
+    if(((curr - h) & mask) >= ((curr - hole) & mask))
+    {
+      bpt->slots[hole] = bpt->slots[curr];
+      hole = curr;
+    }
+    curr = (curr + 1) & mask;
+  }
+  
+  memset(bpt->slots + hole, 0, sizeof(struct breakpoint_data_restore));
+  bpt->counter--;
+  
+  return 1;
+}
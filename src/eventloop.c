@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "eventloop.h"
+
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int timer_fd = -1;
+static int input_watched = 0;
+static sigset_t old_mask;
+
+
+void init_event_loop(void)
+{
+  struct epoll_event ev;
+  sigset_t mask;
+  
+  if(epoll_fd != -1)
+    return;
+  
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT);
+  sigprocmask(SIG_BLOCK, &mask, &old_mask);
+  
+  signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = signal_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+  
+  // The timer is disarmed until event_timer() is called
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  ev.data.fd = timer_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+  
+  // The standard input is registered disabled, event_wait() enables it on demand
+  ev.events = 0;
+  ev.data.fd = STDIN_FILENO;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+  input_watched = 0;
+}
+
+void destroy_event_loop(void)
+{
+  if(epoll_fd == -1)
+    return;
+  
+  close(epoll_fd);
+  close(signal_fd);
+  close(timer_fd);
+  epoll_fd = signal_fd = timer_fd = -1;
+  sigprocmask(SIG_SETMASK, &old_mask, 0);
+}
+
+void event_loop_child_reset(void)
+{
+  sigprocmask(SIG_SETMASK, &old_mask, 0);
+}
+
+static void watch_input(int watch)
+{
+  struct epoll_event ev;
+  
+  if(watch == input_watched)
+    return;
+  
+  memset(&ev, 0, sizeof(ev));
+  ev.events = watch ? EPOLLIN : 0;
+  ev.data.fd = STDIN_FILENO;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+  input_watched = watch;
+}
+
+void event_timer(uint64_t interval_ns)
+{
+  struct itimerspec its;
+  uint64_t expirations;
+  
+  memset(&its, 0, sizeof(its));
+  its.it_interval.tv_sec = interval_ns / 1000000000;
+  its.it_interval.tv_nsec = interval_ns % 1000000000;
+  its.it_value = its.it_interval;
+  timerfd_settime(timer_fd, 0, &its, 0);
+  
+  // An expiration of the previous timer isn't reported
+  if(interval_ns == 0)
+    while(read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+      ;
+}
+
+int event_wait(int watch)
+{
+  struct epoll_event ev;
+  struct signalfd_siginfo si;
+  uint64_t expirations;
+  int n, interrupted = 0, child = 0;
+  
+  watch_input(watch);
+  
+  while((n = epoll_wait(epoll_fd, &ev, 1, -1)) == -1 && errno == EINTR)
+    ;
+  if(n <= 0)
+    return EVENT_NONE;
+  
+  if(ev.data.fd == STDIN_FILENO)
+    return EVENT_INPUT;
+  
+  // The expirations missed meanwhile are merged
+  if(ev.data.fd == timer_fd)
+    return read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) ? EVENT_TIMER : EVENT_NONE;
+  
+  // The pending signals are merged: a SIGINT has the priority, the caller looks for all the children changes anyway
+  while(read(signal_fd, &si, sizeof(si)) == sizeof(si))
+  {
+    if(si.ssi_signo == SIGINT)
+      interrupted = 1;
+    else if(si.ssi_signo == SIGCHLD)
+      child = 1;
+  }
+  
+  if(interrupted)
+    return EVENT_INTERRUPT;
+  
+  return child ? EVENT_CHILD : EVENT_NONE;
+}
@@ -6,6 +6,9 @@
 #include <readline/history.h>
 
 #include "MyDebugger.h"
+#include "tracelog.h"
+#include "symbols.h"
+#include "eventloop.h"
 
 
 typedef struct 
@@ -14,35 +17,59 @@ typedef struct
   void (*action)(char *);
   const char *description;
   char sort_comm;
+  // the command can be used while the process runs in background
+  char while_running;
 } command_type;
 
 
 void _run(char *), 
+  _attach(char *),
+  _detach(char *),
   _kill(char *),
   _break(char *),
   _delb(char *),
+  _ignore(char *),
+  _listb(char *),
   _continue(char *),
+  _interrupt(char *),
+  _thread(char *),
+  _nonstop(char *),
+  _profile(char *),
   _flow(char *),
+  _tdump(char *),
   _next(char *),
   _backtrace(char *),
   _printgr(char *),
+  _printfr(char *),
+  _dump(char *),
   _help(char *),
   _quit(char *);
 
 
 command_type commands[] =
 {
-  { "run", 		_run, 		"run [process] [argument] ......start to tracing the process",'r' },
-  { "kill", 		_kill, 		"kill ..........................kill the traced process",'k' },
-  { "break",		_break, 	"break [address] ...............set a breakpoint", 'b' },
-  { "delb", 		_delb, 		"delb [address] ................delete a breakpoint", 'd' },
-  { "continue", 	_continue, 	"continue ......................continue the exectution after breakpoint or the process started", 'c' },
-  { "flow", 		_flow, 		"flow ..........................execute the process printing all instruction executed, until the first breakpoint (INT 3 instruction)", 'f' },
-  { "next", 		_next, 		"next ..........................execute the next instruction", 'n' },
-  { "backtrace", 	_backtrace,	"backtrace .....................print the stack call trace", 's' },
-  { "printgr",		_printgr, 	"printgr .......................print all general purpose register value", 'p' },
-  { "help",		_help, 		"help ..........................print all commands", 'h' },
-  { "quit",		_quit, 		"quit ..........................quit from the MyDebugger", 0 }
+  { "run", 		_run, 		"run [process] [argument] ......start to tracing the process",'r', 0 },
+  { "attach",		_attach, 	"attach [pid] ..................start to tracing a running process",'a', 0 },
+  { "detach",		_detach, 	"detach ........................remove the breakpoints and leave the traced process running", 0, 0 },
+  { "kill", 		_kill, 		"kill ..........................kill the traced process",'k', 1 },
+  { "break",		_break, 	"break [address] [auto] ........set a breakpoint at an address or a symbol[+offset] (auto: count the hits without stopping)", 'b', 0 },
+  { "delb", 		_delb, 		"delb [address|all] ............delete a breakpoint", 'd', 0 },
+  { "ignore",		_ignore, 	"ignore [address] [count] ......don't stop on the next count hits of a breakpoint", 'i', 0 },
+  { "listb",		_listb, 	"listb .........................list the breakpoints with their hit counters", 'l', 1 },
+  { "continue", 	_continue, 	"continue [&] ..................continue the exectution after breakpoint or the process started (&: in background)", 'c', 0 },
+  { "interrupt", 	_interrupt, 	"interrupt .....................stop the process running in background (or Ctrl-C)", 'z', 1 },
+  { "thread",		_thread, 	"thread [tid] ..................select a thread, without tid list the threads", 'y', 1 },
+  { "nonstop",		_nonstop, 	"nonstop [on|off] ..............only the thread that stops is stopped (off: all the threads stop)", 0, 1 },
+  { "profile",		_profile, 	"profile [hz] [seconds] [file] .sample the call stacks of the threads, print the hot spots and write the collapsed stacks (flame graph input) in file", 'o', 0 },
+  { "flow", 		_flow, 		"flow [blocks|record file [regs] [size]] execute the process printing all instruction executed, until the first breakpoint (INT 3 instruction). With blocks only the branches stop the process, with record the instructions are logged in a binary trace file", 'f', 0 },
+  { "tdump", 		_tdump, 	"tdump [file] [count] ..........decode the last count instructions of a trace file recorded by flow", 't', 1 },
+  { "next", 		_next, 		"next ..........................execute the next instruction", 'n', 0 },
+  { "backtrace", 	_backtrace,	"backtrace .....................print the stack call trace", 's', 0 },
+  { "printgr",		_printgr, 	"printgr .......................print all general purpose register value", 'p', 0 },
+  { "printfr",		_printfr, 	"printfr .......................print the x87/SSE registers (and the AVX ones if available)", 'v', 0 },
+  { "dump",		_dump, 		"dump [address] [size] .........print size bytes of memory starting at address", 'x', 1 },
+  { "help",		_help, 		"help ..........................print all commands", 'h', 1 },
+  { "quit",		_quit, 		"quit ..........................quit from the MyDebugger", 0, 1 }
 };
 
 
@@ -80,7 +107,31 @@ void close_whitespace(char *src)
   src[i] = '\0';
 }
 
-void (*find_command(const char *strcomm))(char *)
+/* An address is a symbol, symbol+offset or a hexadecimal number. Return 0 if the symbol doesn't exist */
+uint64_t parse_address(const char *src)
+{
+  char token[256], *end;
+  uint64_t address;
+  int i;
+  
+  for(i = 0; i < 255 && src[i] != ' ' && src[i] != '\0'; i++)
+    token[i] = src[i];
+  token[i] = '\0';
+  
+  if((address = symbol_address(token)) != 0)
+    return address;
+  
+  address = strtoull(token, &end, 16);
+  if(*end != '\0')
+  {
+    printf("No symbol \"%s\"\n", token);
+    return 0;
+  }
+  
+  return address;
+}
+
+command_type *find_command(const char *strcomm)
 {
   int i;
   char command[256];
@@ -99,13 +150,13 @@ void (*find_command(const char *strcomm))(char *)
   {
     for(i = 0; i < commands_size; i++)
       if(commands[i].sort_comm == command[0])
-	return commands[i].action;
+	return commands + i;
   }
   else
   {
     for(i = 0; i < commands_size; i++)
       if(strcmp(commands[i].commandName, command) == 0)
-	return commands[i].action;
+	return commands + i;
   }
   
   return 0;
@@ -157,6 +208,25 @@ void _run(char *str_comm)
   free(arguments);
 }
 
+void _attach(char *str_comm)
+{
+  char *str;
+  
+  if((str = next_string(str_comm)) == 0)
+  {
+    printf("Enter a valid pid\n");
+    return;
+  }
+  
+  close_whitespace(str);
+  attach_process(strtol(str, 0, 10));
+}
+
+void _detach(char *str_comm)
+{
+  detach_process();
+}
+
 void _kill(char *str_comm)
 {
   kill_process();
@@ -164,8 +234,9 @@ void _kill(char *str_comm)
 
 void _break(char *str_comm)
 {
-  char *_braddr;
+  char *_braddr, *_flag;
   uint64_t addr;
+  int auto_continue = 0;
   
   if( (_braddr = next_string(str_comm)) == 0)
   {
@@ -173,10 +244,13 @@ void _break(char *str_comm)
     return;
   }
   
-  //close_whitespace(_braddr);
-  addr = strtol(_braddr, NULL, 16);
+  if( (_flag = next_string(_braddr)) != 0 && strncmp(_flag, "auto", 4) == 0)
+    auto_continue = 1;
+  
+  if( (addr = parse_address(_braddr)) == 0)
+    return;
   
-  set_breakpoint(addr);
+  set_breakpoint(addr, auto_continue);
 }
 
 void _delb(char *str_comm)
@@ -190,24 +264,174 @@ void _delb(char *str_comm)
     return;
   }
   
-  //close_whitespace(_braddr);
-  addr = strtol(_braddr, NULL, 16);
+  if(strncmp(_braddr, "all", 3) == 0)
+  {
+    delete_all_breakpoints();
+    return;
+  }
+  
+  if( (addr = parse_address(_braddr)) == 0)
+    return;
   
   delete_breakpoint(addr);
 }
 
+void _ignore(char *str_comm)
+{
+  char *_braddr, *_count;
+  uint64_t addr;
+  
+  if( (_braddr = next_string(str_comm)) == 0 || (_count = next_string(_braddr)) == 0)
+  {
+    printf("Enter a breakpoint address and a count\n");
+    return;
+  }
+  
+  if( (addr = parse_address(_braddr)) == 0)
+    return;
+  
+  ignore_breakpoint(addr, strtoul(_count, NULL, 0));
+}
+
+void _listb(char *str_comm)
+{
+  print_breakpoints();
+}
+
 void _continue(char *str_comm)
 {
-  if(continue_execution() == 0)
+  char *str;
+  int ret;
+  
+  if( (str = next_string(str_comm)) != 0 && str[0] == '&')
+    ret = continue_background();
+  else
+    ret = continue_execution();
+  
+  if(ret == 0)
+    clean_debugger();
+}
+
+void _interrupt(char *str_comm)
+{
+  if(process_running())
+    interrupt_process();
+  else
+    printf("The process is not running in background\n");
+}
+
+void _thread(char *str_comm)
+{
+  char *str;
+  
+  if( (str = next_string(str_comm)) == 0)
+  {
+    print_threads();
+    return;
+  }
+  
+  close_whitespace(str);
+  switch_thread(strtol(str, 0, 10));
+}
+
+void _nonstop(char *str_comm)
+{
+  char *str;
+  
+  if( (str = next_string(str_comm)) != 0)
+  {
+    close_whitespace(str);
+    if(strcmp(str, "on") == 0)
+      set_non_stop(1);
+    else if(strcmp(str, "off") == 0)
+      set_non_stop(0);
+    else
+    {
+      printf("Usage: nonstop [on|off]\n");
+      return;
+    }
+  }
+  
+  printf("Non-stop mode is %s\n", non_stop_mode() ? "on" : "off");
+}
+
+void _profile(char *str_comm)
+{
+  char *str, *path = 0;
+  unsigned int hz = 0, seconds = 0;
+  
+  if( (str = next_string(str_comm)) != 0)
+  {
+    hz = strtoul(str, NULL, 10);
+    if( (str = next_string(str)) != 0)
+    {
+      seconds = strtoul(str, NULL, 10);
+      if( (path = next_string(str)) != 0)
+	close_whitespace(path);
+    }
+  }
+  
+  if(profile_execution(hz, seconds, path) == 0)
     clean_debugger();
 }
 
 void _flow(char *str_comm)
 {
-  if(trace_execution() == 0)
+  char *str, *path;
+  uint64_t capacity = 0;
+  int with_regs = 0, ret;
+  
+  if( (str = next_string(str_comm)) == 0)
+    ret = trace_execution();
+  else if(strncmp(str, "blocks", 6) == 0)
+    ret = trace_blocks();
+  else if(strncmp(str, "record", 6) != 0)
+  {
+    printf("Unknown flow mode\n");
+    return;
+  }
+  else
+  {
+    if( (path = next_string(str)) == 0)
+    {
+      printf("Enter a trace file\n");
+      return;
+    }
+    
+    for(str = next_string(path); str != 0; str = next_string(str))
+    {
+      if(strncmp(str, "regs", 4) == 0)
+	with_regs = 1;
+      else
+	capacity = strtoul(str, NULL, 0);
+    }
+    
+    close_whitespace(path);
+    ret = trace_record_execution(path, capacity, with_regs);
+  }
+  
+  if(ret == 0)
     clean_debugger();
 }
 
+void _tdump(char *str_comm)
+{
+  char *path, *str;
+  uint64_t count = 0;
+  
+  if( (path = next_string(str_comm)) == 0)
+  {
+    printf("Enter a trace file\n");
+    return;
+  }
+  
+  if( (str = next_string(path)) != 0)
+    count = strtoul(str, NULL, 0);
+  
+  close_whitespace(path);
+  tracelog_decode(path, count);
+}
+
 void _next(char *str_comm)
 {
   if(next_instruction() == 0)
@@ -216,7 +440,7 @@ void _next(char *str_comm)
 
 void _backtrace(char *str_comm)
 {
-  //TODO
+  print_backtrace();
 }
 
 void _printgr(char *str_comm)
@@ -249,6 +473,87 @@ void _printgr(char *str_comm)
   printf("GS: %lx\n", get_register_value(GS)); 
 }
 
+void _printfr(char *str_comm)
+{
+  const struct user_fpregs_struct *fpregs;
+  const unsigned char *xstate;
+  const uint64_t *ymmh;
+  size_t xsize;
+  int i;
+  
+  if( (fpregs = get_fp_registers()) == 0)
+  {
+    printf("The traced process is not running\n");
+    return;
+  }
+  
+  printf("FCW: %x\n", fpregs->cwd);
+  printf("FSW: %x\n", fpregs->swd);
+  printf("MXCSR: %x\n", fpregs->mxcsr);
+  for(i = 0; i < 8; i++)
+    printf("ST%d: %08x%08x%08x\n", i, fpregs->st_space[i * 4 + 2], fpregs->st_space[i * 4 + 1], fpregs->st_space[i * 4]);
+  
+  // The upper halves of YMM registers are only in the XSAVE area
+  if( (xstate = get_xsave_state(&xsize)) != 0 && xsize >= XSAVE_YMMH_OFFSET + 256)
+  {
+    ymmh = (const uint64_t*)(xstate + XSAVE_YMMH_OFFSET);
+    for(i = 0; i < 16; i++)
+      printf("YMM%d: %016lx%016lx%08x%08x%08x%08x\n", i, ymmh[i * 2 + 1], ymmh[i * 2], 
+	     fpregs->xmm_space[i * 4 + 3], fpregs->xmm_space[i * 4 + 2], fpregs->xmm_space[i * 4 + 1], fpregs->xmm_space[i * 4]);
+  }
+  else
+  {
+    for(i = 0; i < 16; i++)
+      printf("XMM%d: %08x%08x%08x%08x\n", i, 
+	     fpregs->xmm_space[i * 4 + 3], fpregs->xmm_space[i * 4 + 2], fpregs->xmm_space[i * 4 + 1], fpregs->xmm_space[i * 4]);
+  }
+}
+
+void _dump(char *str_comm)
+{
+  char *_addr, *_size;
+  unsigned char *buffer;
+  uint64_t addr;
+  size_t size;
+  ssize_t readed, i;
+  
+  if( (_addr = next_string(str_comm)) == 0)
+  {
+    printf("Enter a memory address\n");
+    return;
+  }
+  
+  if( (addr = parse_address(_addr)) == 0)
+    return;
+  size = 64;
+  if( (_size = next_string(_addr)) != 0)
+    size = strtoul(_size, NULL, 0);
+  
+  if(size == 0)
+    return;
+  
+  buffer = malloc(size);
+  if( (readed = read_memory(addr, buffer, size)) == -1)
+  {
+    printf("Cannot access memory at address %lx\n", addr);
+    free(buffer);
+    return;
+  }
+  
+  for(i = 0; i < readed; i++)
+  {
+    if((i % 16) == 0)
+      printf("%s%lx:", i ? "\n" : "", addr + i);
+    printf(" %02x", buffer[i]);
+  }
+  printf("\n");
+  
+  if(readed < size)
+    printf("Cannot access memory at address %lx\n", addr + readed);
+  
+  free(buffer);
+}
+
 void _help(char *str_comm)
 {
   int i;
@@ -261,22 +566,83 @@ void _quit(char *str_comm)
   execute = 0;
 }
 
+/* readline callback: executes a command line */
+void execute_command(char *command_buffer)
+{
+  command_type *command;
+  
+  // End of input
+  if(command_buffer == 0)
+  {
+    printf("\n");
+    execute = 0;
+    return;
+  }
+  
+  if( (command = find_command(command_buffer)) != 0)
+  {
+    add_history(command_buffer);
+    if(process_running() && !command->while_running)
+      printf("The process is running. Enter 'interrupt' (or Ctrl-C) to stop it\n");
+    else
+      command->action(command_buffer);
+  }
+  else
+    printf("Enter a valid command. Digit 'help' (or h) for help\n");
+  
+  free(command_buffer);
+}
+
+/* Report the stops of the threads running in background */
+void check_process_event(void)
+{
+  int ret;
+  
+  if((ret = process_event()) != -1)
+  {
+    if(ret == 0)
+      clean_debugger();
+    rl_on_new_line();
+    rl_redisplay();
+  }
+}
+
+/* The command line and the process running in background are served by the same event loop */
 void mainLoop(void)
 {
-  char *command_buffer;
-  void (*action)(char *);
+  rl_callback_handler_install("\n> ", execute_command);
   
   while(execute)
   {
-    command_buffer = readline("\n> ");
-    if( (action = find_command(command_buffer)) != 0)
+    switch(event_wait(1))
     {
-      add_history(command_buffer);
-      action(command_buffer);
+      case EVENT_INPUT:
+	rl_callback_read_char();
+	// In non-stop mode a command waiting for a thread can consume the SIGCHLD of the others
+	if(execute && non_stop_mode())
+	  check_process_event();
+	break;
+	
+      case EVENT_CHILD:
+	check_process_event();
+	break;
+	
+      case EVENT_INTERRUPT:
+	if(process_running())
+	  interrupt_process();
+	else
+	{
+	  // Ctrl-C on the prompt discards the line
+	  rl_replace_line("", 0);
+	  rl_crlf();
+	  rl_on_new_line();
+	  rl_redisplay();
+	}
+	break;
     }
-    else
-      printf("Enter a valid command. Digit 'help' (or h) for help\n");
   }
+  
+  rl_callback_handler_remove();
 }
 
 int main(int argc, char *argv[])
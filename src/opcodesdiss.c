@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 
 #include "opcodesdiss.h"
 
@@ -6,22 +8,141 @@
 #include <dis-asm.h>
 
 
+// Direct mapped caches: a collision replaces the old instruction
+#define DECODE_CACHE_SIZE	4096
+#define PAGE_GEN_SIZE		1024
+#define PAGE_SHIFT		12
+
+
+struct render_buffer
+{
+  char *text;
+  size_t length;
+};
+
+
 static struct disassemble_info xdiss;
+static struct render_buffer render;
+static struct decoded_instruction decode_cache[DECODE_CACHE_SIZE];
+/* Generation of the pages (hashed). Writing a page increments its generation, so the instructions decoded before are stale */
+static unsigned int page_gen[PAGE_GEN_SIZE];
+
+
+static inline unsigned int decode_slot(uint64_t address)
+{
+  return (unsigned int)((address * 0x9e3779b97f4a7c15ULL) >> 32) & (DECODE_CACHE_SIZE - 1);
+}
+
+static inline unsigned int *page_generation(uint64_t address)
+{
+  return page_gen + ((address >> PAGE_SHIFT) & (PAGE_GEN_SIZE - 1));
+}
+
+/* libopcodes prints an instruction with several calls: the pieces are collected in the render buffer */
+static int render_printf(void *stream, const char *format, ...)
+{
+  struct render_buffer *rb = (struct render_buffer*)stream;
+  va_list args;
+  int n;
+  
+  va_start(args, format);
+  n = vsnprintf(rb->text + rb->length, DECODED_TEXT_SIZE - rb->length, format, args);
+  va_end(args);
+  
+  if(n > 0)
+    rb->length = (rb->length + n < DECODED_TEXT_SIZE) ? rb->length + n : DECODED_TEXT_SIZE - 1;
+  
+  return n;
+}
 
+/* Classify an instruction from its AT&T mnemonic */
+static char classify_instruction(const char *text)
+{
+  static const char *prefixes[] = { "rep ", "repz ", "repnz ", "repe ", "repne ", "bnd ", "notrack ", "data16 ", "addr32 ", "cs ", "ds ", 0 };
+  int i;
+  
+  // Skips the prefixes (e.g. "bnd jmp", "repz ret", "ds jne")
+  for(i = 0; prefixes[i] != 0; i++)
+    if(strncmp(text, prefixes[i], strlen(prefixes[i])) == 0)
+    {
+      text += strlen(prefixes[i]);
+      i = -1;
+    }
+  
+  if(strncmp(text, "jmp", 3) == 0 || strncmp(text, "ljmp", 4) == 0)
+    return FLOW_JUMP;
+  if(text[0] == 'j' || strncmp(text, "loop", 4) == 0 || strncmp(text, "xbegin", 6) == 0)
+    return FLOW_CONDJUMP;
+  if(strncmp(text, "call", 4) == 0 || strncmp(text, "lcall", 5) == 0)
+    return FLOW_CALL;
+  if(strncmp(text, "ret", 3) == 0 || strncmp(text, "lret", 4) == 0 || strncmp(text, "iret", 4) == 0)
+    return FLOW_RET;
+  if(strncmp(text, "int", 3) == 0 || strncmp(text, "ud", 2) == 0 || strncmp(text, "hlt", 3) == 0 || strncmp(text, "(bad)", 5) == 0)
+    return FLOW_TRAP;
+  
+  return FLOW_NONE;
+}
 
 void init_x86_64_diss(void)
 {  
-  init_disassemble_info(&xdiss, stdout, (fprintf_ftype)fprintf);
+  init_disassemble_info(&xdiss, &render, (fprintf_ftype)render_printf);
   xdiss.mach = bfd_mach_x86_64;
   xdiss.arch = bfd_arch_i386;
   xdiss.endian = BFD_ENDIAN_LITTLE;
   xdiss.buffer_length = INSTRUCTION_MAX_SIZE;
   
+  memset(decode_cache, 0, sizeof(decode_cache));
+}
+
+const struct decoded_instruction *lookup_instruction(uint64_t address)
+{
+  struct decoded_instruction *di = decode_cache + decode_slot(address);
+  
+  if(di->address != address || di->length <= 0 || di->page_gen != *page_generation(address))
+    return 0;
+  
+  return di;
+}
+
+const struct decoded_instruction *decode_instruction(uint64_t address, const unsigned char *instruction)
+{
+  struct decoded_instruction *di = decode_cache + decode_slot(address);
+  
+  render.text = di->text;
+  render.length = 0;
+  di->text[0] = '\0';
+  
+  // The real address is used, so the targets of the relative branches are printed correctly
+  xdiss.buffer = (bfd_byte*)instruction;
+  xdiss.buffer_vma = address;
+  di->length = print_insn_i386(address, &xdiss);
+  di->flow = classify_instruction(di->text);
+  di->address = address;
+  di->page_gen = *page_generation(address);
+  
+  return di;
+}
+
+void invalidate_instructions(uint64_t address, size_t length)
+{
+  uint64_t page;
+  unsigned int i;
+  
+  if(length == 0)
+    return;
+  
+  if((length >> PAGE_SHIFT) >= PAGE_GEN_SIZE)
+  {
+    for(i = 0; i < PAGE_GEN_SIZE; i++)
+      page_gen[i]++;
+    return;
+  }
+  
+  for(page = address >> PAGE_SHIFT; page <= (address + length - 1) >> PAGE_SHIFT; page++)
+    (*page_generation(page << PAGE_SHIFT))++;
 }
 
-void print_instruction(unsigned char *instruction)
+void invalidate_all_instructions(void)
 {
-  xdiss.buffer = instruction;
-  print_insn_i386(0, &xdiss);
-  printf("\n");
+  memset(decode_cache, 0, sizeof(decode_cache));
 }
@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "symbols.h"
+#include "profile.h"
+
+
+#define FUNCTIONS_INIT_SIZE	1024
+#define STACKS_INIT_SIZE	4096
+#define KEYS_INIT_SIZE		(64 * 1024)
+// The tables grow when they are filled at 70%
+#define OVERLOADED(_count, _size)	(((_count) + 1) * 10 > (_size) * 7)
+
+
+static int compare_self(const void *a, const void *b);
+static int compare_total(const void *a, const void *b);
+static void print_function(uint64_t address);
+static void print_table(struct profile_function **sorted, unsigned int n, unsigned int top, int inclusive);
+
+
+/* Functions indexed by address and distinct stacks indexed by hash (open addressing).
+ * The function addresses of the stacks are stored in keys: a sample costs a few symbol lookups and a hash, no allocation once the tables are warm
+ */
+static struct profile_function *functions = 0;
+static unsigned int functions_size = 0;
+static unsigned int functions_count = 0;
+static struct profile_stack *stacks = 0;
+static unsigned int stacks_size = 0;
+static unsigned int stacks_count = 0;
+static uint64_t *keys = 0;
+static size_t keys_size = 0;
+static size_t keys_count = 0;
+static uint64_t samples = 0;
+
+
+static inline unsigned int function_hash(uint64_t address, unsigned int size)
+{
+  return (unsigned int)((address * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static uint64_t stack_hash(const uint64_t *addresses, int n)
+{
+  uint64_t h = n;
+  int i;
+  
+  for(i = 0; i < n; i++)
+    h = (h ^ addresses[i]) * 0x9e3779b97f4a7c15ULL;
+  
+  return h ^ (h >> 32);
+}
+
+static void resize_functions(unsigned int size)
+{
+  struct profile_function *old = functions;
+  unsigned int old_size = functions_size, i, h;
+  
+  functions = calloc(size, sizeof(struct profile_function));
+  functions_size = size;
+  
+  for(i = 0; i < old_size; i++)
+  {
+    if(old[i].address == 0)
+      continue;
+  
+    h = function_hash(old[i].address, size);
+    while(functions[h].address != 0)
+      h = (h + 1) & (size - 1);
+    functions[h] = old[i];
+  }
+  
+  free(old);
+}
+
+static void resize_stacks(unsigned int size)
+{
+  struct profile_stack *old = stacks;
+  unsigned int old_size = stacks_size, i, h;
+  
+  stacks = calloc(size, sizeof(struct profile_stack));
+  stacks_size = size;
+  
+  for(i = 0; i < old_size; i++)
+  {
+    if(old[i].count == 0)
+      continue;
+  
+    h = (unsigned int)old[i].hash & (size - 1);
+    while(stacks[h].count != 0)
+      h = (h + 1) & (size - 1);
+    stacks[h] = old[i];
+  }
+  
+  free(old);
+}
+
+static struct profile_function *find_function(uint64_t address)
+{
+  unsigned int h;
+  
+  if(OVERLOADED(functions_count, functions_size))
+    resize_functions(functions_size * 2);
+  
+  h = function_hash(address, functions_size);
+  while(functions[h].address != 0)
+  {
+    if(functions[h].address == address)
+      return functions + h;
+    h = (h + 1) & (functions_size - 1);
+  }
+  
+  functions[h].address = address;
+  functions_count++;
+  
+  return functions + h;
+}
+
+static void add_stack(const uint64_t *addresses, int n)
+{
+  struct profile_stack *st;
+  uint64_t hash;
+  unsigned int h;
+  
+  if(OVERLOADED(stacks_count, stacks_size))
+    resize_stacks(stacks_size * 2);
+  
+  hash = stack_hash(addresses, n);
+  h = (unsigned int)hash & (stacks_size - 1);
+  while((st = stacks + h)->count != 0)
+  {
+    if(st->hash == hash && st->depth == (unsigned int)n && memcmp(keys + st->offset, addresses, n * sizeof(uint64_t)) == 0)
+    {
+      st->count++;
+      return;
+    }
+    h = (h + 1) & (stacks_size - 1);
+  }
+  
+  if(keys_count + n > keys_size)
+  {
+    while(keys_count + n > keys_size)
+      keys_size *= 2;
+    keys = realloc(keys, keys_size * sizeof(uint64_t));
+  }
+  
+  memcpy(keys + keys_count, addresses, n * sizeof(uint64_t));
+  st->hash = hash;
+  st->count = 1;
+  st->offset = keys_count;
+  st->depth = n;
+  keys_count += n;
+  stacks_count++;
+}
+
+void profile_reset(void)
+{
+  free(functions);
+  free(stacks);
+  free(keys);
+  
+  functions = calloc(FUNCTIONS_INIT_SIZE, sizeof(struct profile_function));
+  functions_size = FUNCTIONS_INIT_SIZE;
+  functions_count = 0;
+  stacks = calloc(STACKS_INIT_SIZE, sizeof(struct profile_stack));
+  stacks_size = STACKS_INIT_SIZE;
+  stacks_count = 0;
+  keys = malloc(KEYS_INIT_SIZE * sizeof(uint64_t));
+  keys_size = KEYS_INIT_SIZE;
+  keys_count = 0;
+  samples = 0;
+}
+
+void profile_add(const struct unwind_frame *frames, int n)
+{
+  uint64_t addresses[UNWIND_MAX_FRAMES], pc, offset;
+  struct profile_function *f;
+  int i;
+  
+  if(n <= 0)
+    return;
+  if(n > UNWIND_MAX_FRAMES)
+    n = UNWIND_MAX_FRAMES;
+  
+  samples++;
+  for(i = 0; i < n; i++)
+  {
+    // A return address can be the first byte after the function (a call to a noreturn function)
+    pc = i == 0 ? frames[i].pc : frames[i].pc - 1;
+    addresses[i] = symbol_name(pc, &offset) != 0 ? pc - offset : frames[i].pc;
+  
+    f = find_function(addresses[i]);
+    if(i == 0)
+      f->self++;
+    if(f->last_sample != samples)
+    {
+      f->total++;
+      f->last_sample = samples;
+    }
+  }
+  
+  add_stack(addresses, n);
+}
+
+uint64_t profile_samples(void)
+{
+  return samples;
+}
+
+void profile_report(unsigned int top)
+{
+  struct profile_function **sorted;
+  unsigned int i, n = 0;
+  
+  if(samples == 0)
+  {
+    printf("No samples\n");
+    return;
+  }
+  
+  sorted = malloc(sizeof(struct profile_function*) * functions_count);
+  for(i = 0; i < functions_size; i++)
+    if(functions[i].address != 0)
+      sorted[n++] = functions + i;
+  
+  qsort(sorted, n, sizeof(struct profile_function*), compare_self);
+  printf("Flat profile:\n");
+  print_table(sorted, n, top, 0);
+  
+  qsort(sorted, n, sizeof(struct profile_function*), compare_total);
+  printf("Inclusive profile:\n");
+  print_table(sorted, n, top, 1);
+  
+  free(sorted);
+}
+
+int profile_write_folded(const char *path)
+{
+  const uint64_t *addresses;
+  const char *name;
+  uint64_t offset;
+  unsigned int i;
+  FILE *f;
+  int j;
+  
+  if((f = fopen(path, "w")) == 0)
+    return -1;
+  
+  // The collapsed stack starts from the outermost frame
+  for(i = 0; i < stacks_size; i++)
+  {
+    if(stacks[i].count == 0)
+      continue;
+  
+    addresses = keys + stacks[i].offset;
+    for(j = stacks[i].depth - 1; j >= 0; j--)
+    {
+      if((name = symbol_name(addresses[j], &offset)) != 0 && offset == 0)
+	fprintf(f, "%s", name);
+      else
+	fprintf(f, "0x%lx", addresses[j]);
+      fputc(j == 0 ? ' ' : ';', f);
+    }
+    fprintf(f, "%lu\n", stacks[i].count);
+  }
+  
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+static int compare_self(const void *a, const void *b)
+{
+  const struct profile_function *fa = *(struct profile_function* const*)a, *fb = *(struct profile_function* const*)b;
+  
+  if(fa->self != fb->self)
+    return fa->self < fb->self ? 1 : -1;
+  if(fa->total != fb->total)
+    return fa->total < fb->total ? 1 : -1;
+  return 0;
+}
+
+static int compare_total(const void *a, const void *b)
+{
+  const struct profile_function *fa = *(struct profile_function* const*)a, *fb = *(struct profile_function* const*)b;
+  
+  if(fa->total != fb->total)
+    return fa->total < fb->total ? 1 : -1;
+  if(fa->self != fb->self)
+    return fa->self < fb->self ? 1 : -1;
+  return 0;
+}
+
+static void print_function(uint64_t address)
+{
+  const char *name;
+  uint64_t offset;
+  
+  if((name = symbol_name(address, &offset)) != 0 && offset == 0)
+    printf("%s\n", name);
+  else
+    printf("%lx\n", address);
+}
+
+static void print_table(struct profile_function **sorted, unsigned int n, unsigned int top, int inclusive)
+{
+  uint64_t count;
+  unsigned int i;
+  
+  printf("  %%time   samples  function\n");
+  for(i = 0; i < n && i < top; i++)
+  {
+    if((count = inclusive ? sorted[i]->total : sorted[i]->self) == 0)
+      break;
+    printf("%6.2f%% %9lu  ", count * 100.0 / samples, count);
+    print_function(sorted[i]->address);
+  }
+}
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbols.h"
+
+
+/* Range of a mapping of the process (anonymous ones too) */
+struct map_region
+{
+  uint64_t start;
+  uint64_t end;
+};
+
+
+static struct symbol_object *objects = 0;
+static unsigned int objects_count = 0;
+static struct map_region *regions = 0;
+static unsigned int regions_count = 0;
+static pid_t symbols_pid = 0;
+static int maps_scanned = 0;
+// last symbol found by symbol_name(): the consecutive instructions of a trace are in the same function
+static const struct symbol_object *last_object = 0;
+static const struct symbol_entry *last_symbol = 0;
+
+
+static void free_objects(void)
+{
+  unsigned int i;
+  
+  for(i = 0; i < objects_count; i++)
+  {
+    if(objects[i].image != 0)
+      munmap(objects[i].image, objects[i].image_size);
+    free(objects[i].path);
+    free(objects[i].symbols);
+    free(objects[i].by_name);
+  }
+  
+  free(objects);
+  free(regions);
+  objects = 0;
+  objects_count = 0;
+  regions = 0;
+  regions_count = 0;
+  last_object = 0;
+  last_symbol = 0;
+}
+
+/* Read /proc/<pid>/maps: every file mapped is an object, its range covers all its mappings */
+static void scan_maps(void)
+{
+  struct symbol_object *obj;
+  char path[64], line[4352], file[4096];
+  unsigned long start, end, offset;
+  unsigned int i, regions_size = 64, objects_size = 16;
+  FILE *maps;
+  
+  free_objects();
+  maps_scanned = 1;
+  
+  snprintf(path, sizeof(path), "/proc/%d/maps", symbols_pid);
+  if((maps = fopen(path, "r")) == 0)
+    return;
+  
+  regions = malloc(sizeof(struct map_region) * regions_size);
+  objects = calloc(objects_size, sizeof(struct symbol_object));
+  
+  while(fgets(line, sizeof(line), maps) != 0)
+  {
+    file[0] = '\0';
+    if(sscanf(line, "%lx-%lx %*s %lx %*s %*s %4095s", &start, &end, &offset, file) < 3)
+      continue;
+    
+    if(regions_count == regions_size)
+    {
+      regions_size *= 2;
+      regions = realloc(regions, sizeof(struct map_region) * regions_size);
+    }
+    regions[regions_count].start = start;
+    regions[regions_count].end = end;
+    regions_count++;
+    
+    if(file[0] != '/')
+      continue;
+    
+    // The mappings of a file are contiguous
+    if(objects_count > 0 && strcmp(objects[objects_count - 1].path, file) == 0)
+    {
+      objects[objects_count - 1].end = end;
+      continue;
+    }
+    
+    if(objects_count == objects_size)
+    {
+      objects_size *= 2;
+      objects = realloc(objects, sizeof(struct symbol_object) * objects_size);
+      memset(objects + objects_count, 0, sizeof(struct symbol_object) * (objects_size - objects_count));
+    }
+    
+    obj = objects + objects_count++;
+    obj->path = strdup(file);
+    // the start of the file image: the bias is computed from it
+    obj->start = start - offset;
+    obj->end = end;
+  }
+  
+  fclose(maps);
+  
+  for(i = 0; i < objects_count; i++)
+    objects[i].bias = objects[i].start;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+  const struct symbol_entry *sa = a, *sb = b;
+  
+  if(sa->address != sb->address)
+    return (sa->address > sb->address) - (sa->address < sb->address);
+  
+  // The sized symbol is preferred to the aliases without size
+  return (sa->size < sb->size) - (sa->size > sb->size);
+}
+
+static const char *sort_strtab;
+static const struct symbol_entry *sort_symbols;
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(sort_strtab + sort_symbols[*(const uint32_t*)a].name, sort_strtab + sort_symbols[*(const uint32_t*)b].name);
+}
+
+/* Map the file of obj and index its symbol table (.symtab, or .dynsym if the file is stripped) */
+static void load_object(struct symbol_object *obj)
+{
+  const Elf64_Ehdr *ehdr;
+  const Elf64_Phdr *phdr;
+  const Elf64_Shdr *shdr, *symtab = 0, *dynsym = 0;
+  const Elf64_Sym *sym;
+  struct stat st;
+  uint64_t count, i;
+  int fd;
+  
+  obj->loaded = 1;
+  
+  if((fd = open(obj->path, O_RDONLY | O_CLOEXEC)) == -1)
+    return;
+  if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(Elf64_Ehdr))
+  {
+    close(fd);
+    return;
+  }
+  
+  // Only the pages of the tables are read, on demand
+  obj->image = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(obj->image == MAP_FAILED)
+  {
+    obj->image = 0;
+    return;
+  }
+  obj->image_size = st.st_size;
+  
+  ehdr = (const Elf64_Ehdr*)obj->image;
+  if(memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 || 
+     ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > obj->image_size ||
+     ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > obj->image_size)
+    return;
+  
+  // The link address of the file image is the one of the first loadable segment
+  phdr = (const Elf64_Phdr*)(obj->image + ehdr->e_phoff);
+  for(i = 0; i < ehdr->e_phnum; i++)
+    if(phdr[i].p_type == PT_LOAD)
+    {
+      obj->bias = obj->start - ((phdr[i].p_vaddr - phdr[i].p_offset) & ~0xfffULL);
+      break;
+    }
+  
+  shdr = (const Elf64_Shdr*)(obj->image + ehdr->e_shoff);
+  for(i = 0; i < ehdr->e_shnum; i++)
+  {
+    if(shdr[i].sh_type == SHT_SYMTAB)
+      symtab = shdr + i;
+    else if(shdr[i].sh_type == SHT_DYNSYM)
+      dynsym = shdr + i;
+  }
+  if(symtab == 0)
+    symtab = dynsym;
+  if(symtab == 0 || symtab->sh_link >= ehdr->e_shnum || symtab->sh_offset + symtab->sh_size > obj->image_size || 
+     shdr[symtab->sh_link].sh_offset + shdr[symtab->sh_link].sh_size > obj->image_size)
+    return;
+  
+  obj->strtab = (const char*)(obj->image + shdr[symtab->sh_link].sh_offset);
+  sym = (const Elf64_Sym*)(obj->image + symtab->sh_offset);
+  count = symtab->sh_size / sizeof(Elf64_Sym);
+  
+  obj->symbols = malloc(sizeof(struct symbol_entry) * (count + 1));
+  for(i = 0; i < count; i++)
+  {
+    if(sym[i].st_shndx == SHN_UNDEF || sym[i].st_value == 0 || sym[i].st_name == 0 || 
+       sym[i].st_name >= shdr[symtab->sh_link].sh_size)
+      continue;
+    if(ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC && ELF64_ST_TYPE(sym[i].st_info) != STT_OBJECT && 
+       ELF64_ST_TYPE(sym[i].st_info) != STT_NOTYPE && ELF64_ST_TYPE(sym[i].st_info) != STT_GNU_IFUNC)
+      continue;
+    
+    obj->symbols[obj->count].address = sym[i].st_value;
+    obj->symbols[obj->count].size = sym[i].st_size;
+    obj->symbols[obj->count].name = sym[i].st_name;
+    obj->count++;
+  }
+  
+  qsort(obj->symbols, obj->count, sizeof(struct symbol_entry), compare_symbols);
+  
+  obj->by_name = malloc(sizeof(uint32_t) * (obj->count + 1));
+  for(i = 0; i < obj->count; i++)
+    obj->by_name[i] = i;
+  sort_strtab = obj->strtab;
+  sort_symbols = obj->symbols;
+  qsort(obj->by_name, obj->count, sizeof(uint32_t), compare_names);
+}
+
+static const struct symbol_entry *find_by_name(const struct symbol_object *obj, const char *name)
+{
+  unsigned int low = 0, high = obj->count, mid;
+  int cmp;
+  
+  while(low < high)
+  {
+    mid = (low + high) / 2;
+    if((cmp = strcmp(name, obj->strtab + obj->symbols[obj->by_name[mid]].name)) == 0)
+      return obj->symbols + obj->by_name[mid];
+    if(cmp < 0)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+  
+  return 0;
+}
+
+/* The symbol containing address (relative to the object), or the nearest one before it if it has no size */
+static const struct symbol_entry *find_by_address(const struct symbol_object *obj, uint64_t address)
+{
+  unsigned int low = 0, high = obj->count, mid;
+  const struct symbol_entry *sym;
+  
+  // the last symbol with address <= address
+  while(low < high)
+  {
+    mid = (low + high) / 2;
+    if(obj->symbols[mid].address <= address)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if(low == 0)
+    return 0;
+  
+  // The first of the aliases is the sized one
+  sym = obj->symbols + low - 1;
+  while(sym > obj->symbols && (sym - 1)->address == sym->address)
+    sym--;
+  
+  if(sym->size != 0 && address - sym->address >= sym->size)
+    return 0;
+  
+  return sym;
+}
+
+static int known_address(uint64_t address)
+{
+  unsigned int i;
+  
+  for(i = 0; i < regions_count; i++)
+    if(address >= regions[i].start && address < regions[i].end)
+      return 1;
+  
+  return 0;
+}
+
+void symbols_open(pid_t pid)
+{
+  free_objects();
+  symbols_pid = pid;
+  maps_scanned = 0;
+}
+
+void symbols_close(void)
+{
+  free_objects();
+  symbols_pid = 0;
+  maps_scanned = 0;
+}
+
+uint64_t symbol_address(const char *name)
+{
+  const struct symbol_entry *sym;
+  char symbol[256], *plus, *end;
+  uint64_t offset = 0;
+  unsigned int i;
+  int rescan = 0;
+  
+  if(symbols_pid == 0)
+    return 0;
+  
+  snprintf(symbol, sizeof(symbol), "%s", name);
+  if((plus = strchr(symbol, '+')) != 0)
+  {
+    *plus = '\0';
+    offset = strtoull(plus + 1, &end, 0);
+    if(*end != '\0')
+      return 0;
+  }
+  
+  // The executable (the first object) is searched first, then the shared objects in load order
+  if(!maps_scanned)
+    scan_maps();
+  else
+    rescan = 1;
+  
+  while(1)
+  {
+    for(i = 0; i < objects_count; i++)
+    {
+      if(!objects[i].loaded)
+	load_object(objects + i);
+      if((sym = find_by_name(objects + i, symbol)) != 0)
+	return sym->address + objects[i].bias + offset;
+    }
+    
+    // The symbol could be in a library loaded after the last scan
+    if(!rescan)
+      return 0;
+    rescan = 0;
+    scan_maps();
+  }
+}
+
+const char *symbol_name(uint64_t address, uint64_t *offset)
+{
+  const struct symbol_entry *sym;
+  struct symbol_object *obj;
+  
+  if(symbols_pid == 0)
+    return 0;
+  
+  if(last_symbol != 0 && address - last_object->bias - last_symbol->address < last_symbol->size)
+  {
+    *offset = address - last_object->bias - last_symbol->address;
+    return last_object->strtab + last_symbol->name;
+  }
+  
+  if((obj = symbol_object_at(address)) == 0 || (sym = find_by_address(obj, address - obj->bias)) == 0)
+    return 0;
+  
+  last_object = obj;
+  last_symbol = sym;
+  *offset = address - obj->bias - sym->address;
+  return obj->strtab + sym->name;
+}
+
+struct symbol_object *symbol_object_at(uint64_t address)
+{
+  struct symbol_object *obj;
+  unsigned int i;
+  
+  if(symbols_pid == 0)
+    return 0;
+  
+  // A new mapping (a library loaded later): the maps are read again
+  if(!maps_scanned || !known_address(address))
+    scan_maps();
+  
+  for(i = 0; i < objects_count; i++)
+  {
+    obj = objects + i;
+    if(address < obj->start || address >= obj->end)
+      continue;
+    
+    if(!obj->loaded)
+      load_object(obj);
+    return obj;
+  }
+  
+  return 0;
+}
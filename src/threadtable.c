@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "MyDebugger.h"
+#include "threadtable.h"
+
+
+#define THTABLE_INIT_SIZE	16
+// The table grows when it is filled at 70%
+#define THTABLE_OVERLOADED(_tt)		(((_tt)->counter + 1) * 10 > (_tt)->size * 7)
+
+
+static inline unsigned int thtable_hash(const struct thread_table *tt, pid_t tid)
+{
+  return (unsigned int)(((uint64_t)tid * 0x9e3779b97f4a7c15ULL) >> 32) & (tt->size - 1);
+}
+
+static void thtable_resize(struct thread_table *tt, unsigned int size)
+{
+  struct thread_state **old = tt->slots;
+  unsigned int old_size = tt->size, i, h;
+  
+  tt->slots = calloc(size, sizeof(struct thread_state*));
+  tt->size = size;
+  
+  for(i = 0; i < old_size; i++)
+  {
+    if(old[i] == 0)
+      continue;
+    
+    h = thtable_hash(tt, old[i]->tid);
+    while(tt->slots[h] != 0)
+      h = (h + 1) & (size - 1);
+    tt->slots[h] = old[i];
+  }
+  
+  free(old);
+}
+
+void thtable_init(struct thread_table *tt)
+{
+  tt->slots = calloc(THTABLE_INIT_SIZE, sizeof(struct thread_state*));
+  tt->size = THTABLE_INIT_SIZE;
+  tt->counter = 0;
+}
+
+void thtable_destroy(struct thread_table *tt)
+{
+  thtable_clear(tt);
+  free(tt->slots);
+  tt->slots = 0;
+  tt->size = 0;
+}
+
+void thtable_clear(struct thread_table *tt)
+{
+  unsigned int i;
+  
+  for(i = 0; i < tt->size; i++)
+  {
+    free(tt->slots[i]);
+    tt->slots[i] = 0;
+  }
+  tt->counter = 0;
+}
+
+struct thread_state *thtable_find(struct thread_table *tt, pid_t tid)
+{
+  unsigned int h = thtable_hash(tt, tid);
+  
+  while(tt->slots[h] != 0)
+  {
+    if(tt->slots[h]->tid == tid)
+      return tt->slots[h];
+    h = (h + 1) & (tt->size - 1);
+  }
+  
+  return 0;
+}
+
+struct thread_state *thtable_insert(struct thread_table *tt, pid_t tid)
+{
+  struct thread_state *th;
+  unsigned int h;
+  
+  if(THTABLE_OVERLOADED(tt))
+    thtable_resize(tt, tt->size * 2);
+  
+  h = thtable_hash(tt, tid);
+  while(tt->slots[h] != 0)
+  {
+    if(tt->slots[h]->tid == tid)
+      return 0;
+    h = (h + 1) & (tt->size - 1);
+  }
+  
+  th = calloc(1, sizeof(struct thread_state));
+  th->tid = tid;
+  th->state_flags = INTERRUPTED;
+  tt->slots[h] = th;
+  tt->counter++;
+  
+  return th;
+}
+
+int thtable_remove(struct thread_table *tt, pid_t tid)
+{
+  unsigned int hole, curr, h, mask = tt->size - 1;
+  
+  hole = thtable_hash(tt, tid);
+  while(tt->slots[hole] != 0 && tt->slots[hole]->tid != tid)
+    hole = (hole + 1) & mask;
+  
+  if(tt->slots[hole] == 0)
+    return 0;
+  
+  free(tt->slots[hole]);
+  
+  /* Backward shift deletion (as the breakpoint table) */
+  curr = (hole + 1) & mask;
+  while(tt->slots[curr] != 0)
+  {
+    h = thtable_hash(tt, tt->slots[curr]->tid);
+    if(((curr - h) & mask) >= ((curr - hole) & mask))
+    {
+      tt->slots[hole] = tt->slots[curr];
+      hole = curr;
+    }
+    curr = (curr + 1) & mask;
+  }
+  
+  tt->slots[hole] = 0;
+  tt->counter--;
+  
+  return 1;
+}
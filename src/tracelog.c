@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "opcodesdiss.h"
+#include "tracelog.h"
+
+
+struct code_set
+{
+  struct trace_code *slots;
+  uint64_t size;
+  uint64_t counter;
+};
+
+
+static struct trace_header *trace = 0;
+static struct trace_record *ring;
+static size_t trace_map_size;
+static int trace_fd = -1;
+static struct code_set codes;
+
+// Register names in sys/reg.h order
+static const char *reg_names[] =
+{
+  "R15", "R14", "R13", "R12", "RBP", "RBX", "R11", "R10", "R9", "R8", "RAX", "RCX", "RDX", "RSI", "RDI", 
+  "ORIG_RAX", "RIP", "CS", "EFLAGS", "RSP", "SS", "FS_BASE", "GS_BASE", "DS", "ES", "FS", "GS"
+};
+
+
+static inline uint64_t code_hash(uint64_t address, uint64_t size)
+{
+  return ((address * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static struct trace_code *code_slot(struct code_set *set, uint64_t address)
+{
+  uint64_t h = code_hash(address, set->size);
+  
+  while(set->slots[h].address != 0 && set->slots[h].address != address)
+    h = (h + 1) & (set->size - 1);
+  
+  return set->slots + h;
+}
+
+static void code_set_init(struct code_set *set, uint64_t size)
+{
+  set->slots = calloc(size, sizeof(struct trace_code));
+  set->size = size;
+  set->counter = 0;
+}
+
+static void code_set_insert(struct code_set *set, const struct trace_code *code)
+{
+  struct trace_code *old = set->slots, *slot;
+  uint64_t old_size = set->size, i;
+  
+  if((set->counter + 1) * 10 > set->size * 7)
+  {
+    code_set_init(set, old_size * 2);
+    for(i = 0; i < old_size; i++)
+      if(old[i].address != 0)
+      {
+	*code_slot(set, old[i].address) = old[i];
+	set->counter++;
+      }
+    free(old);
+  }
+  
+  slot = code_slot(set, code->address);
+  if(slot->address == 0)
+    set->counter++;
+  *slot = *code;
+}
+
+int tracelog_open(const char *path, uint64_t capacity)
+{
+  if(trace != 0)
+    tracelog_close();
+  
+  if(capacity == 0)
+    capacity = TRACELOG_DEFAULT_SIZE;
+  
+  if((trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+  {
+    printf("Cannot create %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  
+  trace_map_size = sizeof(struct trace_header) + capacity * sizeof(struct trace_record);
+  if(ftruncate(trace_fd, trace_map_size) == -1 || 
+     (trace = mmap(0, trace_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, trace_fd, 0)) == MAP_FAILED)
+  {
+    printf("Cannot map %s: %s\n", path, strerror(errno));
+    close(trace_fd);
+    trace_fd = -1;
+    trace = 0;
+    return 0;
+  }
+  
+  memcpy(trace->magic, TRACELOG_MAGIC, sizeof(trace->magic));
+  trace->record_size = sizeof(struct trace_record);
+  trace->code_size = sizeof(struct trace_code);
+  trace->capacity = capacity;
+  trace->head = 0;
+  trace->code_count = 0;
+  ring = (struct trace_record*)(trace + 1);
+  
+  code_set_init(&codes, 1024);
+  
+  return 1;
+}
+
+void tracelog_insn(uint64_t rip)
+{
+  struct trace_record *rec = ring + (trace->head++ % trace->capacity);
+  
+  rec->value = rip;
+  rec->kind = TRACE_INSN;
+  rec->reg = 0;
+}
+
+void tracelog_reg(unsigned int reg, uint64_t value)
+{
+  struct trace_record *rec = ring + (trace->head++ % trace->capacity);
+  
+  rec->value = value;
+  rec->kind = TRACE_REG;
+  rec->reg = reg;
+}
+
+int tracelog_has_code(uint64_t address)
+{
+  return code_slot(&codes, address)->address == address;
+}
+
+void tracelog_add_code(uint64_t address, const unsigned char *code)
+{
+  struct trace_code tc;
+  
+  tc.address = address;
+  memcpy(tc.code, code, sizeof(tc.code));
+  code_set_insert(&codes, &tc);
+}
+
+void tracelog_close(void)
+{
+  uint64_t i;
+  
+  if(trace == 0)
+    return;
+  
+  trace->code_count = codes.counter;
+  munmap(trace, trace_map_size);
+  trace = 0;
+  
+  // The snapshots are appended after the ring
+  lseek(trace_fd, trace_map_size, SEEK_SET);
+  for(i = 0; i < codes.size; i++)
+    if(codes.slots[i].address != 0 && write(trace_fd, codes.slots + i, sizeof(struct trace_code)) == -1)
+      printf("Cannot write the trace file: %s\n", strerror(errno));
+  
+  close(trace_fd);
+  trace_fd = -1;
+  
+  free(codes.slots);
+  memset(&codes, 0, sizeof(codes));
+}
+
+int tracelog_decode(const char *path, uint64_t count)
+{
+  const struct trace_header *header;
+  const struct trace_record *records, *rec;
+  const struct trace_code *snapshots;
+  struct code_set set;
+  struct stat st;
+  uint64_t first, i;
+  size_t ring_size;
+  int fd;
+  
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &st) == -1)
+  {
+    printf("Cannot open %s: %s\n", path, strerror(errno));
+    if(fd != -1)
+      close(fd);
+    return 0;
+  }
+  
+  if(st.st_size < sizeof(struct trace_header) || 
+     (header = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    printf("%s is not a trace file\n", path);
+    close(fd);
+    return 0;
+  }
+  close(fd);
+  
+  ring_size = header->capacity * sizeof(struct trace_record);
+  if(memcmp(header->magic, TRACELOG_MAGIC, sizeof(header->magic)) != 0 || 
+     header->record_size != sizeof(struct trace_record) || header->code_size != sizeof(struct trace_code) ||
+     st.st_size < sizeof(struct trace_header) + ring_size + header->code_count * sizeof(struct trace_code))
+  {
+    printf("%s is not a trace file\n", path);
+    munmap((void*)header, st.st_size);
+    return 0;
+  }
+  
+  records = (const struct trace_record*)(header + 1);
+  snapshots = (const struct trace_code*)((const char*)records + ring_size);
+  
+  code_set_init(&set, 1024);
+  for(i = 0; i < header->code_count; i++)
+    code_set_insert(&set, snapshots + i);
+  
+  // The oldest records have been overwritten if the ring is wrapped
+  first = header->head > header->capacity ? header->head - header->capacity : 0;
+  if(count != 0)
+  {
+    // Walks back to the first record of the last count instructions
+    for(i = header->head; i > first && count > 0; i--)
+      if(records[(i - 1) % header->capacity].kind == TRACE_INSN)
+	count--;
+    first = i;
+  }
+  
+  for(i = first; i < header->head; i++)
+  {
+    rec = records + (i % header->capacity);
+    if(rec->kind == TRACE_INSN)
+    {
+      struct trace_code *tc = code_slot(&set, rec->value);
+      
+      if(tc->address == rec->value)
+	printf("%lx: \t\t%s\n", rec->value, decode_instruction(rec->value, tc->code)->text);
+      else
+	printf("%lx: \t\t(code not recorded)\n", rec->value);
+    }
+    else if(rec->kind == TRACE_REG && rec->reg < sizeof(reg_names) / sizeof(char*))
+      printf("\t\t\t%s = %lx\n", reg_names[rec->reg], rec->value);
+  }
+  
+  printf("%lu records, %lu dropped\n", header->head, header->head > header->capacity ? header->head - header->capacity : 0);
+  
+  free(set.slots);
+  munmap((void*)header, st.st_size);
+  
+  return 1;
+}
@@ -0,0 +1,719 @@
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#include "symbols.h"
+#include "unwind.h"
+
+
+// DWARF numbers of the x86-64 registers used by the unwinder
+#define DW_REG_RBP		6
+#define DW_REG_RSP		7
+#define DW_REG_RA		16
+
+#define DW_CFA_nop				0x00
+#define DW_CFA_set_loc				0x01
+#define DW_CFA_advance_loc1			0x02
+#define DW_CFA_advance_loc2			0x03
+#define DW_CFA_advance_loc4			0x04
+#define DW_CFA_offset_extended			0x05
+#define DW_CFA_restore_extended			0x06
+#define DW_CFA_undefined			0x07
+#define DW_CFA_same_value			0x08
+#define DW_CFA_register				0x09
+#define DW_CFA_remember_state			0x0a
+#define DW_CFA_restore_state			0x0b
+#define DW_CFA_def_cfa				0x0c
+#define DW_CFA_def_cfa_register			0x0d
+#define DW_CFA_def_cfa_offset			0x0e
+#define DW_CFA_def_cfa_expression		0x0f
+#define DW_CFA_expression			0x10
+#define DW_CFA_offset_extended_sf		0x11
+#define DW_CFA_def_cfa_sf			0x12
+#define DW_CFA_def_cfa_offset_sf		0x13
+#define DW_CFA_val_offset			0x14
+#define DW_CFA_val_offset_sf			0x15
+#define DW_CFA_val_expression			0x16
+#define DW_CFA_GNU_args_size			0x2e
+#define DW_CFA_GNU_negative_offset_extended	0x2f
+
+#define DW_EH_PE_omit		0xff
+#define DW_EH_PE_pcrel		0x10
+#define DW_EH_PE_datarel	0x30
+#define DW_EH_PE_indirect	0x80
+// .eh_frame_hdr table encoding supported by the binary search (the one used by the linkers)
+#define EH_HDR_TABLE_ENC	0x3b
+#define EH_HDR_COUNT_ENC	0x03
+
+// Unwind rows cached by pc (direct mapped)
+#define UNWIND_CACHE_SIZE	4096
+// The stack is read in windows of STACK_WINDOW_SIZE bytes: usually one transfer for the whole trace
+#define STACK_WINDOW_SIZE	(64 * 1024)
+#define CFA_STATE_STACK		8
+
+
+enum register_rule
+{
+  RULE_SAME =		0,	// the register isn't changed by the function
+  RULE_OFFSET =		1,	// the register is saved at CFA + offset
+  RULE_UNDEFINED =	2,	// not recoverable (the return address of the outermost frame)
+  RULE_UNSUPPORTED =	3	// DWARF expressions
+};
+
+/* How the caller's registers are found at a pc: CFA = cfa_reg + cfa_offset, RBP and RA by their rules */
+struct unwind_row
+{
+  uint64_t pc;
+  int64_t cfa_offset;
+  int64_t rbp_offset;
+  int64_t ra_offset;
+  unsigned char cfa_reg;
+  unsigned char rbp_rule;
+  unsigned char ra_rule;
+  // 0 if no CFI covers pc: the frame pointer is used
+  unsigned char valid;
+};
+
+struct cie_info
+{
+  uint64_t code_align;
+  int64_t data_align;
+  uint64_t ra_reg;
+  unsigned char fde_encoding;
+  // the FDEs have the augmentation data size ("z")
+  char augmentation_size;
+  const unsigned char *instructions;
+  const unsigned char *end;
+};
+
+/* A section of the mapped file and its link address */
+struct eh_section
+{
+  const unsigned char *data;
+  uint64_t addr;
+  size_t size;
+};
+
+struct stack_window
+{
+  uint64_t base;
+  ssize_t size;
+  unsigned char buffer[STACK_WINDOW_SIZE];
+};
+
+
+static struct unwind_row row_cache[UNWIND_CACHE_SIZE];
+static struct stack_window window;
+
+
+static inline unsigned int row_hash(uint64_t pc)
+{
+  return ((pc * 0x9e3779b97f4a7c15ULL) >> 32) & (UNWIND_CACHE_SIZE - 1);
+}
+
+static uint64_t read_uleb(const unsigned char **p, const unsigned char *end)
+{
+  uint64_t value = 0;
+  unsigned int shift = 0;
+  
+  while(*p < end)
+  {
+    value |= (uint64_t)(**p & 0x7f) << shift;
+    shift += 7;
+    if((*(*p)++ & 0x80) == 0)
+      break;
+  }
+  
+  return value;
+}
+
+static int64_t read_sleb(const unsigned char **p, const unsigned char *end)
+{
+  int64_t value = 0;
+  unsigned int shift = 0;
+  unsigned char byte = 0;
+  
+  while(*p < end)
+  {
+    byte = *(*p)++;
+    value |= (int64_t)(byte & 0x7f) << shift;
+    shift += 7;
+    if((byte & 0x80) == 0)
+      break;
+  }
+  
+  if(shift < 64 && (byte & 0x40))
+    value |= -((int64_t)1 << shift);
+  
+  return value;
+}
+
+/* Read a pointer with a DW_EH_PE_* encoding. The pc relative ones are link addresses too */
+static int read_encoded(const unsigned char **p, const unsigned char *end, unsigned char encoding, const struct eh_section *sec, uint64_t *value)
+{
+  uint64_t field = sec->addr + (*p - sec->data);
+  size_t size;
+  
+  if(encoding == DW_EH_PE_omit)
+    return 0;
+  
+  switch(encoding & 0x0f)
+  {
+    case 0x00:	size = 8;	break;
+    case 0x01:	*value = read_uleb(p, end);	size = 0;	break;
+    case 0x02:
+    case 0x0a:	size = 2;	break;
+    case 0x03:
+    case 0x0b:	size = 4;	break;
+    case 0x04:
+    case 0x0c:	size = 8;	break;
+    case 0x09:	*value = read_sleb(p, end);	size = 0;	break;
+    default:	return 0;
+  }
+  
+  if(size != 0)
+  {
+    if(*p + size > end)
+      return 0;
+    
+    switch(encoding & 0x0f)
+    {
+      case 0x02:	*value = *(const uint16_t*)*p;	break;
+      case 0x0a:	*value = *(const int16_t*)*p;	break;
+      case 0x03:	*value = *(const uint32_t*)*p;	break;
+      case 0x0b:	*value = *(const int32_t*)*p;	break;
+      default:		*value = *(const uint64_t*)*p;	break;
+    }
+    *p += size;
+  }
+  
+  if((encoding & 0x70) == DW_EH_PE_pcrel)
+    *value += field;
+  
+  return (encoding & DW_EH_PE_indirect) == 0;
+}
+
+/* Find .eh_frame_hdr and .eh_frame in the mapped file of obj */
+static void load_unwind_tables(struct symbol_object *obj)
+{
+  const Elf64_Ehdr *ehdr;
+  const Elf64_Shdr *shdr;
+  const char *names;
+  unsigned int i;
+  
+  obj->unwind_loaded = 1;
+  
+  if(obj->image == 0)
+    return;
+  
+  ehdr = (const Elf64_Ehdr*)obj->image;
+  if(memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_shstrndx >= ehdr->e_shnum ||
+     ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > obj->image_size)
+    return;
+  
+  shdr = (const Elf64_Shdr*)(obj->image + ehdr->e_shoff);
+  if(shdr[ehdr->e_shstrndx].sh_offset >= obj->image_size)
+    return;
+  names = (const char*)(obj->image + shdr[ehdr->e_shstrndx].sh_offset);
+  
+  for(i = 0; i < ehdr->e_shnum; i++)
+  {
+    if(shdr[i].sh_type == SHT_NOBITS || shdr[i].sh_offset + shdr[i].sh_size > obj->image_size || 
+       shdr[i].sh_name >= shdr[ehdr->e_shstrndx].sh_size)
+      continue;
+    
+    if(strcmp(names + shdr[i].sh_name, ".eh_frame_hdr") == 0)
+    {
+      obj->eh_frame_hdr = obj->image + shdr[i].sh_offset;
+      obj->eh_frame_hdr_addr = shdr[i].sh_addr;
+      obj->eh_frame_hdr_size = shdr[i].sh_size;
+    }
+    else if(strcmp(names + shdr[i].sh_name, ".eh_frame") == 0)
+    {
+      obj->eh_frame = obj->image + shdr[i].sh_offset;
+      obj->eh_frame_addr = shdr[i].sh_addr;
+      obj->eh_frame_size = shdr[i].sh_size;
+    }
+  }
+}
+
+/* Return the start of the CIE/FDE entry at p and its end, 0 if it's malformed. id points to the CIE id (or pointer) */
+static const unsigned char *entry_bounds(const unsigned char *p, const unsigned char *end, const unsigned char **id, const unsigned char **entry_end, int *wide)
+{
+  uint64_t length;
+  
+  if(p + 4 > end)
+    return 0;
+  
+  length = *(const uint32_t*)p;
+  *wide = 0;
+  p += 4;
+  if(length == 0xffffffff)
+  {
+    if(p + 8 > end)
+      return 0;
+    length = *(const uint64_t*)p;
+    *wide = 1;
+    p += 8;
+  }
+  
+  if(length == 0 || length > (uint64_t)(end - p))
+    return 0;
+  
+  *id = p;
+  *entry_end = p + length;
+  return p;
+}
+
+static int parse_cie(const unsigned char *cie, const struct eh_section *sec, struct cie_info *info)
+{
+  const unsigned char *p, *end, *id, *aug_end = 0;
+  const char *augmentation;
+  uint64_t personality, aug_length;
+  unsigned char version, encoding;
+  int wide;
+  
+  if((p = entry_bounds(cie, sec->data + sec->size, &id, &end, &wide)) == 0)
+    return 0;
+  
+  p += wide ? 8 : 4;
+  if(p >= end)
+    return 0;
+  version = *p++;
+  augmentation = (const char*)p;
+  while(p < end && *p != 0)
+    p++;
+  if(p++ >= end)
+    return 0;
+  
+  // The augmentations without a size ("eh") are obsolete
+  if(augmentation[0] != '\0' && augmentation[0] != 'z')
+    return 0;
+  
+  info->code_align = read_uleb(&p, end);
+  info->data_align = read_sleb(&p, end);
+  info->ra_reg = version == 1 ? *p++ : read_uleb(&p, end);
+  info->fde_encoding = 0;
+  info->augmentation_size = augmentation[0] == 'z';
+  
+  if(augmentation[0] == 'z')
+  {
+    aug_length = read_uleb(&p, end);
+    aug_end = p + aug_length;
+    augmentation++;
+    for(; *augmentation != '\0' && p < end; augmentation++)
+    {
+      switch(*augmentation)
+      {
+	case 'R':
+	  info->fde_encoding = *p++;
+	  break;
+	case 'L':
+	  p++;
+	  break;
+	case 'P':
+	  encoding = *p++;
+	  read_encoded(&p, end, encoding & ~DW_EH_PE_indirect, sec, &personality);
+	  break;
+	case 'S':
+	  break;
+	default:
+	  // unknown augmentation: its data is skipped with the size
+	  p = aug_end;
+	  break;
+      }
+    }
+    p = aug_end;
+  }
+  
+  if(p > end)
+    return 0;
+  
+  info->instructions = p;
+  info->end = end;
+  
+  return 1;
+}
+
+/* Return the FDE covering the link address pc: binary search in .eh_frame_hdr if available, otherwise a scan of .eh_frame */
+static const unsigned char *find_fde(const struct symbol_object *obj, uint64_t pc)
+{
+  const unsigned char *p, *end, *id, *entry_end, *hdr = obj->eh_frame_hdr;
+  const int32_t *table;
+  struct eh_section sec = { obj->eh_frame, obj->eh_frame_addr, obj->eh_frame_size };
+  struct cie_info cie;
+  uint64_t eh_frame_ptr, count, fde_addr, begin, range;
+  int64_t target;
+  unsigned int low, high, mid;
+  int wide;
+  
+  if(obj->eh_frame == 0)
+    return 0;
+  
+  if(hdr != 0 && obj->eh_frame_hdr_size >= 12 && hdr[0] == 1 && hdr[2] == EH_HDR_COUNT_ENC && hdr[3] == EH_HDR_TABLE_ENC)
+  {
+    struct eh_section hsec = { hdr, obj->eh_frame_hdr_addr, obj->eh_frame_hdr_size };
+    
+    p = hdr + 4;
+    if(read_encoded(&p, hdr + obj->eh_frame_hdr_size, hdr[1], &hsec, &eh_frame_ptr) && 
+       read_encoded(&p, hdr + obj->eh_frame_hdr_size, hdr[2], &hsec, &count) && 
+       p + count * 8 <= hdr + obj->eh_frame_hdr_size)
+    {
+      // Sorted pairs (initial location, FDE address) relative to the header
+      table = (const int32_t*)p;
+      target = (int64_t)(pc - obj->eh_frame_hdr_addr);
+      low = 0;
+      high = count;
+      while(low < high)
+      {
+	mid = (low + high) / 2;
+	if(table[mid * 2] <= target)
+	  low = mid + 1;
+	else
+	  high = mid;
+      }
+      if(low == 0)
+	return 0;
+      
+      fde_addr = obj->eh_frame_hdr_addr + table[(low - 1) * 2 + 1];
+      if(fde_addr < obj->eh_frame_addr || fde_addr >= obj->eh_frame_addr + obj->eh_frame_size)
+	return 0;
+      return obj->eh_frame + (fde_addr - obj->eh_frame_addr);
+    }
+  }
+  
+  // No usable index: linear scan (the rows found are cached anyway)
+  p = obj->eh_frame;
+  end = obj->eh_frame + obj->eh_frame_size;
+  while(p < end && entry_bounds(p, end, &id, &entry_end, &wide) != 0)
+  {
+    // A CIE has id 0, an FDE the offset back to its CIE
+    if((wide ? *(const uint64_t*)id : *(const uint32_t*)id) != 0 && 
+       parse_cie(id - (wide ? *(const uint64_t*)id : *(const uint32_t*)id), &sec, &cie))
+    {
+      id += wide ? 8 : 4;
+      if(read_encoded(&id, entry_end, cie.fde_encoding, &sec, &begin) && read_encoded(&id, entry_end, cie.fde_encoding & 0x0f, &sec, &range) && 
+	 pc >= begin && pc - begin < range)
+	return p;
+    }
+    p = entry_end;
+  }
+  
+  return 0;
+}
+
+static void set_rule(struct unwind_row *row, uint64_t reg, unsigned char rule, int64_t offset)
+{
+  if(reg == DW_REG_RBP)
+  {
+    row->rbp_rule = rule;
+    row->rbp_offset = offset;
+  }
+  else if(reg == DW_REG_RA)
+  {
+    row->ra_rule = rule;
+    row->ra_offset = offset;
+  }
+}
+
+static void restore_rule(struct unwind_row *row, const struct unwind_row *initial, uint64_t reg)
+{
+  if(reg == DW_REG_RBP)
+    set_rule(row, reg, initial->rbp_rule, initial->rbp_offset);
+  else if(reg == DW_REG_RA)
+    set_rule(row, reg, initial->ra_rule, initial->ra_offset);
+}
+
+/* Execute the CFA instructions from the location loc up to the link address pc. Return 0 if an instruction is not supported */
+static int execute_cfa(const unsigned char *p, const unsigned char *end, const struct cie_info *cie, const struct eh_section *sec, 
+		       uint64_t loc, uint64_t pc, struct unwind_row *row, const struct unwind_row *initial)
+{
+  struct unwind_row stack[CFA_STATE_STACK];
+  uint64_t reg, value;
+  unsigned char op;
+  int depth = 0;
+  
+  while(p < end)
+  {
+    op = *p++;
+    
+    switch(op & 0xc0)
+    {
+      case 0x40:
+	if((loc += (op & 0x3f) * cie->code_align) > pc)
+	  return 1;
+	continue;
+      case 0x80:
+	set_rule(row, op & 0x3f, RULE_OFFSET, read_uleb(&p, end) * cie->data_align);
+	continue;
+      case 0xc0:
+	restore_rule(row, initial, op & 0x3f);
+	continue;
+    }
+    
+    switch(op)
+    {
+      case DW_CFA_nop:
+	break;
+      case DW_CFA_set_loc:
+	if(!read_encoded(&p, end, cie->fde_encoding, sec, &loc))
+	  return 0;
+	if(loc > pc)
+	  return 1;
+	break;
+      case DW_CFA_advance_loc1:
+	if(p + 1 > end)
+	  return 0;
+	loc += *p * cie->code_align;
+	p += 1;
+	if(loc > pc)
+	  return 1;
+	break;
+      case DW_CFA_advance_loc2:
+	if(p + 2 > end)
+	  return 0;
+	loc += *(const uint16_t*)p * cie->code_align;
+	p += 2;
+	if(loc > pc)
+	  return 1;
+	break;
+      case DW_CFA_advance_loc4:
+	if(p + 4 > end)
+	  return 0;
+	loc += *(const uint32_t*)p * cie->code_align;
+	p += 4;
+	if(loc > pc)
+	  return 1;
+	break;
+      case DW_CFA_offset_extended:
+	reg = read_uleb(&p, end);
+	set_rule(row, reg, RULE_OFFSET, read_uleb(&p, end) * cie->data_align);
+	break;
+      case DW_CFA_offset_extended_sf:
+	reg = read_uleb(&p, end);
+	set_rule(row, reg, RULE_OFFSET, read_sleb(&p, end) * cie->data_align);
+	break;
+      case DW_CFA_GNU_negative_offset_extended:
+	reg = read_uleb(&p, end);
+	set_rule(row, reg, RULE_OFFSET, -(int64_t)read_uleb(&p, end) * cie->data_align);
+	break;
+      case DW_CFA_restore_extended:
+	restore_rule(row, initial, read_uleb(&p, end));
+	break;
+      case DW_CFA_undefined:
+	set_rule(row, read_uleb(&p, end), RULE_UNDEFINED, 0);
+	break;
+      case DW_CFA_same_value:
+	set_rule(row, read_uleb(&p, end), RULE_SAME, 0);
+	break;
+      case DW_CFA_register:
+	reg = read_uleb(&p, end);
+	read_uleb(&p, end);
+	set_rule(row, reg, RULE_UNSUPPORTED, 0);
+	break;
+      case DW_CFA_remember_state:
+	if(depth == CFA_STATE_STACK)
+	  return 0;
+	stack[depth++] = *row;
+	break;
+      case DW_CFA_restore_state:
+	if(depth == 0)
+	  return 0;
+	*row = stack[--depth];
+	break;
+      case DW_CFA_def_cfa:
+	row->cfa_reg = read_uleb(&p, end);
+	row->cfa_offset = read_uleb(&p, end);
+	break;
+      case DW_CFA_def_cfa_sf:
+	row->cfa_reg = read_uleb(&p, end);
+	row->cfa_offset = read_sleb(&p, end) * cie->data_align;
+	break;
+      case DW_CFA_def_cfa_register:
+	row->cfa_reg = read_uleb(&p, end);
+	break;
+      case DW_CFA_def_cfa_offset:
+	row->cfa_offset = read_uleb(&p, end);
+	break;
+      case DW_CFA_def_cfa_offset_sf:
+	row->cfa_offset = read_sleb(&p, end) * cie->data_align;
+	break;
+      case DW_CFA_def_cfa_expression:
+	// (the PLT entries) the frame pointer is used
+	value = read_uleb(&p, end);
+	p += value;
+	row->cfa_reg = 0xff;
+	break;
+      case DW_CFA_expression:
+      case DW_CFA_val_expression:
+	reg = read_uleb(&p, end);
+	value = read_uleb(&p, end);
+	p += value;
+	set_rule(row, reg, RULE_UNSUPPORTED, 0);
+	break;
+      case DW_CFA_val_offset:
+	reg = read_uleb(&p, end);
+	read_uleb(&p, end);
+	set_rule(row, reg, RULE_UNSUPPORTED, 0);
+	break;
+      case DW_CFA_val_offset_sf:
+	reg = read_uleb(&p, end);
+	read_sleb(&p, end);
+	set_rule(row, reg, RULE_UNSUPPORTED, 0);
+	break;
+      case DW_CFA_GNU_args_size:
+	read_uleb(&p, end);
+	break;
+      default:
+	return 0;
+    }
+  }
+  
+  return 1;
+}
+
+/* Compute the unwind row of the runtime address pc from the CFI of its object */
+static void compute_row(uint64_t pc, struct unwind_row *row)
+{
+  struct symbol_object *obj;
+  const unsigned char *fde, *p, *id, *end;
+  struct unwind_row initial;
+  struct cie_info cie;
+  struct eh_section sec;
+  uint64_t link_pc, begin, range, length;
+  int wide;
+  
+  memset(row, 0, sizeof(struct unwind_row));
+  row->pc = pc;
+  
+  if((obj = symbol_object_at(pc)) == 0)
+    return;
+  if(!obj->unwind_loaded)
+    load_unwind_tables(obj);
+  
+  link_pc = pc - obj->bias;
+  if((fde = find_fde(obj, link_pc)) == 0)
+    return;
+  
+  sec.data = obj->eh_frame;
+  sec.addr = obj->eh_frame_addr;
+  sec.size = obj->eh_frame_size;
+  
+  if(entry_bounds(fde, sec.data + sec.size, &id, &end, &wide) == 0)
+    return;
+  length = wide ? *(const uint64_t*)id : *(const uint32_t*)id;
+  if(length == 0 || (uint64_t)(id - sec.data) < length || !parse_cie(id - length, &sec, &cie))
+    return;
+  
+  p = id + (wide ? 8 : 4);
+  if(!read_encoded(&p, end, cie.fde_encoding, &sec, &begin) || !read_encoded(&p, end, cie.fde_encoding & 0x0f, &sec, &range))
+    return;
+  if(link_pc < begin || link_pc - begin >= range)
+    return;
+  if(cie.augmentation_size)
+  {
+    length = read_uleb(&p, end);
+    p += length;
+  }
+  
+  // The CIE instructions give the initial rules (the target of DW_CFA_restore)
+  initial.cfa_reg = DW_REG_RSP;
+  initial.cfa_offset = 8;
+  initial.rbp_rule = RULE_SAME;
+  initial.ra_rule = RULE_UNDEFINED;
+  if(!execute_cfa(cie.instructions, cie.end, &cie, &sec, begin, begin, &initial, &initial))
+    return;
+  
+  *row = initial;
+  row->pc = pc;
+  if(!execute_cfa(p, end, &cie, &sec, begin, link_pc, row, &initial))
+  {
+    row->valid = 0;
+    return;
+  }
+  
+  row->valid = row->cfa_reg == DW_REG_RSP || row->cfa_reg == DW_REG_RBP;
+}
+
+static int read_stack(memory_reader read, uint64_t address, uint64_t *value)
+{
+  if(address < window.base || address + sizeof(uint64_t) > window.base + window.size)
+  {
+    // The next frames are above: they are in the same window
+    window.base = address;
+    if((window.size = read(address, window.buffer, STACK_WINDOW_SIZE)) < (ssize_t)sizeof(uint64_t))
+    {
+      window.size = 0;
+      return 0;
+    }
+  }
+  
+  memcpy(value, window.buffer + (address - window.base), sizeof(uint64_t));
+  return 1;
+}
+
+int unwind_stack(uint64_t rip, uint64_t rsp, uint64_t rbp, memory_reader read, struct unwind_frame *frames, int max)
+{
+  struct unwind_row *row;
+  uint64_t pc = rip, cfa, ra, lookup;
+  int n = 0;
+  
+  // A new stop: the stack content is changed
+  window.size = 0;
+  
+  while(n < max && pc != 0)
+  {
+    // The return address can be the start of the next function (a call to a noreturn function)
+    lookup = n == 0 ? pc : pc - 1;
+    row = row_cache + row_hash(lookup);
+    if(row->pc != lookup)
+      compute_row(lookup, row);
+    
+    if(row->valid)
+    {
+      if(row->ra_rule != RULE_OFFSET)
+      {
+	// The outermost frame (RA undefined)
+	frames[n].pc = pc;
+	frames[n++].cfa = 0;
+	break;
+      }
+      
+      cfa = (row->cfa_reg == DW_REG_RSP ? rsp : rbp) + row->cfa_offset;
+      if(!read_stack(read, cfa + row->ra_offset, &ra))
+	break;
+      if(row->rbp_rule == RULE_OFFSET && !read_stack(read, cfa + row->rbp_offset, &rbp))
+	break;
+    }
+    else
+    {
+      // Frame pointer: [rbp] is the caller's rbp, [rbp + 8] the return address
+      if(rbp == 0 || rbp < rsp)
+      {
+	frames[n].pc = pc;
+	frames[n++].cfa = 0;
+	break;
+      }
+      cfa = rbp + 16;
+      if(!read_stack(read, rbp + 8, &ra) || !read_stack(read, rbp, &rbp))
+	break;
+    }
+    
+    frames[n].pc = pc;
+    frames[n++].cfa = cfa;
+    
+    // The stack grows down: a frame that doesn't move up is corrupted
+    if(cfa <= rsp)
+      break;
+    rsp = cfa;
+    pc = ra;
+  }
+  
+  return n;
+}
+
+void unwind_reset(void)
+{
+  memset(row_cache, 0, sizeof(row_cache));
+  window.size = 0;
+}